@@ -0,0 +1,250 @@
+/** @file   bench.c
+ *  @brief  Micro benchmarks of thread pool.
+ *
+ *  @author t-kenji <protect.2501@gmail.com>
+ *  @date   2019-03-02 create new.
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#include "threads.h"
+#include "thread_pool.h"
+
+#define MAX_PRODUCERS (64)
+#define FANOUT_SPIN (256)
+
+/**
+ *  Submission benchmark context.
+ */
+struct submit_bench {
+    tpool_t tp;                 /**< Pool under test. */
+    size_t jobs_per_producer;   /**< Jobs each producer submits. */
+    _Atomic(bool) start;        /**< Start gate for producers. */
+    _Atomic(size_t) done;       /**< Number of finished jobs. */
+};
+
+/**
+ *  Fan-out benchmark context.
+ */
+struct fanout_bench {
+    tgroup_t grp;           /**< Group of every node. */
+    _Atomic(size_t) done;   /**< Number of finished nodes. */
+};
+
+/**
+ *  Node of a binomial tree, carried inline by its job.
+ */
+struct fanout_node {
+    struct fanout_bench *b; /**< Benchmark the node belongs to. */
+    size_t depth;           /**< Depth of the subtree rooted here. */
+};
+
+/**
+ *  Current monotonic time in nanoseconds.
+ */
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int count_job(void *arg)
+{
+    struct submit_bench *b = arg;
+    atomic_fetch_add_explicit(&b->done, 1, memory_order_relaxed);
+    return 0;
+}
+
+static int producer(void *arg)
+{
+    struct submit_bench *b = arg;
+
+    while (!atomic_load(&b->start)) {
+        thrd_yield();
+    }
+    for (size_t i = 0; i < b->jobs_per_producer; ++i) {
+        job_t job;
+        thrdpool_job_init(&job, count_job, b);
+        while (thrdpool_add(b->tp, &job) != 0) {
+            thrd_yield();
+        }
+    }
+
+    return 0;
+}
+
+/**
+ *  Jobs per second with @c num_producers threads submitting concurrently.
+ */
+static double bench_submit(size_t num_workers, size_t num_producers, size_t jobs_per_producer)
+{
+    struct submit_bench b = {
+        .tp = thrdpool_create(num_workers),
+        .jobs_per_producer = jobs_per_producer,
+    };
+    atomic_init(&b.start, false);
+    atomic_init(&b.done, 0);
+    if (b.tp == NULL) {
+        perror("thrdpool_create");
+        exit(1);
+    }
+
+    thrd_t thrs[MAX_PRODUCERS];
+    for (size_t i = 0; i < num_producers; ++i) {
+        if (thrd_create(&thrs[i], producer, &b) != 0) {
+            perror("thrd_create");
+            exit(1);
+        }
+    }
+
+    size_t total = num_producers * jobs_per_producer;
+    int64_t begin = now_ns();
+    atomic_store(&b.start, true);
+    while (atomic_load(&b.done) < total) {
+        thrd_yield();
+    }
+    int64_t elapsed = now_ns() - begin;
+
+    for (size_t i = 0; i < num_producers; ++i) {
+        thrd_join(thrs[i], NULL);
+    }
+    thrdpool_destroy(b.tp);
+
+    return (double)total * 1e9 / (double)elapsed;
+}
+
+/**
+ *  Child k roots a subtree of depth k, so the first child spawned holds
+ *  the smallest share and the last one half of the tree.
+ */
+static int fanout_job(void *arg)
+{
+    struct fanout_node node = *(struct fanout_node *)arg;
+
+    for (size_t k = 0; k < node.depth; ++k) {
+        struct fanout_node child = {.b = node.b, .depth = k};
+        job_t job;
+        thrdpool_job_init(&job, fanout_job, NULL);
+        thrdpool_job_set_inline_arg(&job, &child, sizeof(child));
+        while (thrdpool_group_add(node.b->grp, &job) != 0) {
+            thrd_yield();
+        }
+    }
+    for (volatile int i = 0; i < FANOUT_SPIN; ++i) {
+    }
+    atomic_fetch_add_explicit(&node.b->done, 1, memory_order_relaxed);
+
+    return 0;
+}
+
+/**
+ *  Nodes per second running a binomial tree of @c depth, 2^depth nodes
+ *  spawned from inside the pool, and the number of jobs stolen.
+ */
+static double bench_fanout(size_t num_workers, size_t depth, uint64_t *stolen)
+{
+    tpool_t tp = thrdpool_create(num_workers);
+    if (tp == NULL) {
+        perror("thrdpool_create");
+        exit(1);
+    }
+    struct fanout_bench b = {
+        .grp = thrdpool_group_create(tp),
+    };
+    atomic_init(&b.done, 0);
+    if (b.grp == NULL) {
+        perror("thrdpool_group_create");
+        exit(1);
+    }
+
+    struct fanout_node root = {.b = &b, .depth = depth};
+    job_t job;
+    thrdpool_job_init(&job, fanout_job, NULL);
+    thrdpool_job_set_inline_arg(&job, &root, sizeof(root));
+
+    int64_t begin = now_ns();
+    if (thrdpool_group_add(b.grp, &job) != 0) {
+        perror("thrdpool_group_add");
+        exit(1);
+    }
+    thrdpool_group_wait(b.grp);
+    int64_t elapsed = now_ns() - begin;
+
+    static tstats_t stats;
+    *stolen = 0;
+    if (thrdpool_stats(tp, &stats) == 0) {
+        for (size_t i = 0; i < stats.num_workers; ++i) {
+            *stolen += stats.workers[i].stolen;
+        }
+    }
+    thrdpool_group_destroy(b.grp);
+    thrdpool_destroy(tp);
+
+    return (double)atomic_load(&b.done) * 1e9 / (double)elapsed;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s submit [workers] [jobs-per-producer]\n"
+            "       %s fanout [workers] [depth]\n",
+            prog, prog);
+}
+
+/**
+ *  Startup routine.
+ *
+ *  @param  [in]    argc    Command-line arguments count.
+ *  @param  [in]    argv    Command-line arguments vector.
+ *  @return On success, zero is returned.
+ *          On error, 1 is returned.
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "submit") == 0) {
+        size_t num_workers = (argc > 2) ? strtoul(argv[2], NULL, 0) : 4;
+        size_t jobs = (argc > 3) ? strtoul(argv[3], NULL, 0) : 20000;
+
+        printf("%10s %16s\n", "producers", "jobs/sec");
+        for (size_t p = 1; p <= MAX_PRODUCERS; p *= 2) {
+            printf("%10zu %16.0f\n", p, bench_submit(num_workers, p, jobs));
+            fflush(stdout);
+        }
+        return 0;
+    }
+
+    if (strcmp(argv[1], "fanout") == 0) {
+        size_t num_workers = (argc > 2) ? strtoul(argv[2], NULL, 0) : 4;
+        size_t depth = (argc > 3) ? strtoul(argv[3], NULL, 0) : 18;
+
+        printf("%10s %16s %16s\n", "workers", "nodes/sec", "stolen");
+        for (size_t w = 1; w <= num_workers; w *= 2) {
+            uint64_t stolen;
+            double rate = bench_fanout(w, depth, &stolen);
+            printf("%10zu %16.0f %16" PRIu64 "\n", w, rate, stolen);
+            fflush(stdout);
+        }
+        return 0;
+    }
+
+    usage(argv[0]);
+    return 1;
+}
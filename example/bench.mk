@@ -0,0 +1,4 @@
+# Makefile for Coop-tasks library Benchmark.
+
+EXECUTABLE = bench
+OBJS = bench.o
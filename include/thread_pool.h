@@ -15,33 +15,451 @@ extern "C" {
 #endif
 
 #define JOB_NAME_MAX (32)
+#define JOB_INLINE_MAX (48)
 
 typedef uint32_t juid_t;
 
+/**
+ *  Priority levels, a lower value runs first.
+ */
+enum thrdpool_priority {
+    THRDPOOL_PRIO_HIGH = 0,
+    THRDPOOL_PRIO_NORMAL,
+    THRDPOOL_PRIO_LOW,
+};
+
+#define THRDPOOL_PRIORITIES (3)
+#define THRDPOOL_MAX_TENANTS (64)
+
+struct job_record;
+struct thread_pool_group;
+struct thread_pool_graph;
+struct thread_pool_timer;
+struct thread_pool_cancel;
+struct thread_pool_tenant;
+
+/**
+ *  Handle of a waitable job, valid until waited or released.
+ */
+typedef struct job_handle {
+    struct job_record *rec;
+    uint32_t gen;
+} jhandle_t;
+
+/**
+ *  Handle of a delayed or periodic job, valid until it fires or is cancelled.
+ */
+typedef struct timer_handle {
+    struct thread_pool_timer *tmr;
+    uint32_t gen;
+} thandle_t;
+
+/**
+ *  Outcome of a waitable job.
+ */
+typedef struct job_result {
+    int value;          /**< Return value of job_t::func. */
+    int64_t start_time; /**< CLOCK_MONOTONIC nanoseconds. */
+    int64_t end_time;   /**< CLOCK_MONOTONIC nanoseconds. */
+} jresult_t;
+
 typedef struct job {
     /* private */
     juid_t id;
-    int64_t start_time;
-    int64_t end_time;
+    uint16_t name; /* Interned by thrdpool_job_set_name(), zero if unnamed. */
+    uint8_t inline_size; /* Bytes of @c data set by thrdpool_job_set_inline_arg(). */
 
     /* public */
+    bool waitable;
+    bool inlined; /**< The job runs on @c data, @c arg is ignored. */
+    uint8_t priority; /**< One of enum thrdpool_priority. */
+    int64_t deadline; /**< CLOCK_MONOTONIC nanoseconds, zero if none. */
+    struct thread_pool_cancel *cancel; /**< Set by thrdpool_job_set_cancel(). */
+    uint32_t tag; /**< Set by thrdpool_job_set_tag(), zero if none. */
+    struct thread_pool_tenant *tenant; /**< Set by thrdpool_job_set_tenant(). */
     int (*func)(void *);
     void *arg;
-    char name[JOB_NAME_MAX];
-    bool waitable;
+    uint64_t data[JOB_INLINE_MAX / sizeof(uint64_t)]; /**< Set by thrdpool_job_set_inline_arg(). */
+    void (*dtor)(void *); /**< Called on the argument once the job has run or been dropped. */
+    jhandle_t handle; /**< Set by thrdpool_add() if waitable. */
+    struct thread_pool_group *group; /**< Set by thrdpool_group_add(). */
+    thandle_t timer; /**< Set by thrdpool_add_after() and thrdpool_add_every(). */
 } job_t;
 
 typedef struct thread_pool *tpool_t;
+typedef struct thread_pool_group *tgroup_t;
+typedef struct thread_pool_graph *tgraph_t;
+typedef struct thread_pool_cancel *tcancel_t;
+typedef struct thread_pool_tenant *ttenant_t;
+
+/**
+ *  Capacity of unbounded queues, they grow instead of rejecting jobs.
+ */
+#define THRDPOOL_UNBOUNDED (0)
+
+/**
+ *  No deadline for thrdpool_shutdown().
+ */
+#define THRDPOOL_FOREVER (UINT64_MAX)
+
+/**
+ *  What thrdpool_shutdown() does with jobs that have not started yet.
+ */
+enum thrdpool_shutdown_mode {
+    THRDPOOL_DRAIN = 0x1,   /**< Run them before stopping. */
+    THRDPOOL_DISCARD = 0x2, /**< Drop them, waitable ones complete with -ECANCELED. */
+};
+
+/**
+ *  Where workers are pinned.
+ */
+enum thrdpool_placement {
+    THRDPOOL_PLACE_NONE,    /**< Leave it to the scheduler. */
+    THRDPOOL_PLACE_COMPACT, /**< Pack onto SMT siblings and shared caches first. */
+    THRDPOOL_PLACE_SCATTER, /**< Spread across caches and nodes first. */
+    THRDPOOL_PLACE_CPUSET,  /**< Confine every worker to an explicit set. */
+};
+
+typedef struct thread_pool_attr {
+    size_t num_workers;    /**< Workers kept alive, the minimum if elastic. */
+    size_t max_workers;    /**< Upper bound of elastic workers. */
+    size_t grow_threshold; /**< Queued jobs that make a busy pool grow. */
+    uint64_t idle_timeout; /**< Milliseconds before an extra worker retires. */
+    size_t max_spare;      /**< Workers started beyond the others to make up for blocked ones. */
+    uint64_t blocking_threshold; /**< Milliseconds a worker stays blocked before it is made up for. */
+    size_t capacity; /**< Jobs per queue, or THRDPOOL_UNBOUNDED. */
+    bool profiling;  /**< Record per-name wait and run time histograms. */
+    bool busy_poll;  /**< Never park idle workers. */
+    bool thread_names; /**< Rename workers after the named job they run. */
+    bool deadline_mode; /**< Run the earliest deadline first. */
+    bool drop_expired;  /**< Drop jobs whose deadline has passed, in deadline mode. */
+    enum thrdpool_placement placement;
+    cpu_set_t cpuset; /**< Used by THRDPOOL_PLACE_CPUSET. */
+} tpool_attr_t;
+
+/**
+ *  Buckets of a log-linear histogram, 8 per power of two up to 2^40 ns.
+ */
+#define THRDPOOL_HISTO_BUCKETS (304)
+
+/**
+ *  Histogram of nanosecond durations.
+ */
+typedef struct job_histogram {
+    uint64_t count;
+    uint64_t total; /**< Sum of all durations. */
+    uint64_t max;
+    uint64_t buckets[THRDPOOL_HISTO_BUCKETS];
+} jhisto_t;
+
+/**
+ *  Timings of all jobs sharing a name.
+ */
+typedef struct job_stats {
+    char name[JOB_NAME_MAX];
+    jhisto_t wait; /**< From submission to start. */
+    jhisto_t run;  /**< From start to end. */
+} jstats_t;
+
+/**
+ *  Counters of one worker.
+ */
+typedef struct thread_pool_worker_stats {
+    uint64_t executed;
+    uint64_t stolen;
+    uint64_t steal_failures; /**< Steals lost to the owner or another thief. */
+    uint64_t parks;
+    uint64_t unparks;
+    uint64_t idle_time;      /**< Nanoseconds spent parked. */
+    uint64_t expired;        /**< Jobs dropped past their deadline. */
+    uint64_t cancelled;      /**< Jobs skipped as cancelled. */
+    size_t local_depth;
+    bool running;
+    bool blocked;            /**< Inside thrdpool_blocking_begin(). */
+    juid_t job_id;           /**< Running job, valid if running. */
+    char job_name[JOB_NAME_MAX];
+} twstats_t;
+
+/**
+ *  Snapshot of a pool.
+ */
+typedef struct thread_pool_stats {
+    size_t num_workers; /**< Worker slots, the maximum if elastic. */
+    size_t num_alive;
+    size_t num_active;
+    size_t num_idle;
+    size_t global_depth;
+    size_t num_blocked;
+    uint64_t compensations; /**< Workers woken or started for blocked ones. */
+    twstats_t workers[MAX_THREADS];
+    uint64_t *steals; /**< NULL, or num_workers x num_workers steals by thief then victim. */
+} tstats_t;
+
+/**
+ *  Counters of one tenant.
+ */
+typedef struct thread_pool_tenant_stats {
+    uint32_t weight;
+    size_t depth;         /**< Jobs queued. */
+    uint64_t served;      /**< Jobs run. */
+    uint64_t served_time; /**< Nanoseconds spent running its jobs. */
+} ttstats_t;
 
 int thrdpool_job_init(job_t *job, int (*func)(void *), void *arg);
+
+/**
+ *  Name the job, names are interned once per process and shared by ID.
+ *
+ *  Interned names are kept until the process exits. Up to 32767 distinct
+ *  names fit; once they are used up, jobs given a new name stay unnamed
+ *  and the call still succeeds. Avoid per-request names such as "req-%d".
+ */
 int thrdpool_job_set_name(job_t *job, const char *name);
+const char *thrdpool_job_get_name(const job_t *job);
+
+/**
+ *  Name of the job running on the calling thread, NULL if there is none
+ *  or it is unnamed. Only reads a thread-local label, so it is safe to
+ *  call from a signal handler; debuggers find it in @c thrdpool_job_label.
+ */
+const char *thrdpool_current_job_name(void);
 int thrdpool_job_set_waitable(job_t *job, bool waitable);
 
+/**
+ *  Queue the job at @c priority, THRDPOOL_PRIO_NORMAL by default.
+ *  A worker serves a lower level after every few jobs it picks from
+ *  the levels above, so low priority jobs are delayed but never starved.
+ */
+int thrdpool_job_set_priority(job_t *job, enum thrdpool_priority priority);
+
+/**
+ *  Set the absolute CLOCK_MONOTONIC @c deadline in nanoseconds, used by
+ *  pools in deadline mode. Zero clears it.
+ */
+int thrdpool_job_set_deadline(job_t *job, int64_t deadline);
+
+/**
+ *  Skip the job without running it if @c cancel is requested before a
+ *  worker picks it up, it then completes with -ECANCELED. The job keeps
+ *  the token alive while queued or running.
+ */
+int thrdpool_job_set_cancel(job_t *job, tcancel_t cancel);
+
+/**
+ *  Tag the job for thrdpool_cancel_tag(), ignored if it has a token.
+ */
+int thrdpool_job_set_tag(job_t *job, uint32_t tag);
+
+tcancel_t thrdpool_cancel_create(void);
+
+/**
+ *  Drop the caller's reference, jobs holding the token keep it alive.
+ */
+void thrdpool_cancel_destroy(tcancel_t cancel);
+int thrdpool_cancel_request(tcancel_t cancel);
+bool thrdpool_cancel_requested(tcancel_t cancel);
+
+/**
+ *  Whether the job running on the calling thread has been cancelled,
+ *  for long jobs to poll and return early.
+ */
+bool thrdpool_cancelled(void);
+
+/**
+ *  Queue the job on @c tenant instead of the pool's own queue. Tenants
+ *  only queue normal priority jobs, adding one at another level fails
+ *  with EINVAL.
+ */
+int thrdpool_job_set_tenant(job_t *job, ttenant_t tenant);
+
+/**
+ *  Bracket a part of the running job that may block, such as I/O or
+ *  waiting on another thread. Calls nest and do nothing outside of a
+ *  worker. thrdpool_wait() marks itself while the job is not done.
+ */
+void thrdpool_blocking_begin(void);
+void thrdpool_blocking_end(void);
+
+/**
+ *  Carry a copy of @c size bytes at @c data, at most JOB_INLINE_MAX, in the
+ *  job itself and run it on the copy. The caller's buffer may go away as
+ *  soon as this returns. Copies of more than 24 bytes are queued in a
+ *  pooled buffer instead of the queue entry.
+ */
+int thrdpool_job_set_inline_arg(job_t *job, const void *data, size_t size);
+
+/**
+ *  Release the argument with @c dtor once the job has run or been dropped.
+ */
+int thrdpool_job_set_destructor(job_t *job, void (*dtor)(void *));
+
+int thrdpool_attr_init(tpool_attr_t *attr, size_t num_workers);
+int thrdpool_attr_set_capacity(tpool_attr_t *attr, size_t capacity);
+int thrdpool_attr_set_profiling(tpool_attr_t *attr, bool profiling);
+
+/**
+ *  Keep idle workers polling for jobs instead of parking them, which
+ *  trades a whole core per worker for wake-up latency. Meant for workers
+ *  pinned to isolated cores.
+ */
+int thrdpool_attr_set_busy_poll(tpool_attr_t *attr, bool busy_poll);
+
+/**
+ *  Also set the kernel thread name to the job name while a named job runs,
+ *  for tools that only see /proc. Costs two syscalls per named job.
+ */
+int thrdpool_attr_set_thread_names(tpool_attr_t *attr, bool thread_names);
+
+/**
+ *  Run queued jobs earliest deadline first instead of in FIFO order,
+ *  priorities are ignored. Jobs without a deadline run after those with
+ *  one, unless added by a running job, whose deadline they inherit.
+ *  If @c drop_expired is set, a job picked after its deadline is dropped
+ *  and its handle completes with -ETIMEDOUT.
+ */
+int thrdpool_attr_set_deadline_mode(tpool_attr_t *attr, bool deadline_mode, bool drop_expired);
+
+/**
+ *  Let the pool grow up to @c max_workers while every worker is busy and
+ *  @c grow_threshold jobs are queued, extra workers retire after
+ *  @c idle_timeout milliseconds parked.
+ */
+int thrdpool_attr_set_elastic(tpool_attr_t *attr, size_t max_workers,
+                              size_t grow_threshold, uint64_t idle_timeout);
+int thrdpool_attr_set_placement(tpool_attr_t *attr, enum thrdpool_placement placement,
+                                const cpu_set_t *cpuset);
+
+/**
+ *  Make up for workers blocked longer than @c threshold milliseconds
+ *  between thrdpool_blocking_begin() and thrdpool_blocking_end(), by
+ *  waking an idle worker or starting up to @c max_spare extra ones while
+ *  jobs are waiting. Extra workers retire like elastic ones.
+ */
+int thrdpool_attr_set_compensation(tpool_attr_t *attr, size_t max_spare, uint64_t threshold);
+
 tpool_t thrdpool_create(size_t num_workers);
+tpool_t thrdpool_create_attr(const tpool_attr_t *attr);
 void thrdpool_destroy(tpool_t tp);
+
+/**
+ *  Stop accepting jobs from outside the pool, settle the queued ones as
+ *  @c mode says and join the workers. Running jobs are always finished.
+ *  Fails with ETIMEDOUT if draining takes longer than @c deadline
+ *  milliseconds, unless THRDPOOL_DISCARD drops the rest at that point.
+ */
+int thrdpool_shutdown(tpool_t tp, int mode, uint64_t deadline);
+
+/**
+ *  Block until no job is queued or running, armed timers do not count.
+ */
+int thrdpool_wait_idle(tpool_t tp);
 ssize_t thrdpool_num_workers(tpool_t tp);
 int thrdpool_add(tpool_t tp, job_t *job);
 
+/**
+ *  Queue @c num jobs at once, all or none. They must share one priority
+ *  and tenant.
+ */
+int thrdpool_add_batch(tpool_t tp, job_t *jobs, size_t num);
+
+/**
+ *  Submit a copy of @c job after @c delay milliseconds, it cannot have a tenant.
+ */
+int thrdpool_add_after(tpool_t tp, job_t *job, uint64_t delay);
+
+/**
+ *  Submit a copy of @c job every @c period milliseconds until cancelled.
+ *  The job cannot be waitable nor carry a token, a tag or a tenant.
+ */
+int thrdpool_add_every(tpool_t tp, job_t *job, uint64_t period);
+
+/**
+ *  Cancel every job added so far with @c tag, queued ones are skipped
+ *  and running ones see thrdpool_cancelled(). Jobs added afterwards with
+ *  the same tag are not affected.
+ */
+int thrdpool_cancel_tag(tpool_t tp, uint32_t tag);
+
+/**
+ *  Cancel a timer that has not fired yet, ESRCH otherwise.
+ *
+ *  A waitable job of the timer completes with -ECANCELED.
+ */
+int thrdpool_timer_cancel(thandle_t timer);
+
+int thrdpool_wait(jhandle_t handle, jresult_t *result);
+int thrdpool_try_wait(jhandle_t handle, jresult_t *result);
+int thrdpool_release(jhandle_t handle);
+
+/**
+ *  Add a tenant with its own queue, served in proportion to @c weight.
+ *
+ *  Workers share the time spent on normal priority jobs among the
+ *  tenants by deficit round-robin, jobs added without a tenant count as
+ *  one more tenant of weight 1. Tenants live as long as the pool, not
+ *  available in deadline mode.
+ */
+ttenant_t thrdpool_tenant_create(tpool_t tp, uint32_t weight);
+int thrdpool_tenant_set_weight(ttenant_t tenant, uint32_t weight);
+int thrdpool_tenant_stats(ttenant_t tenant, ttstats_t *stats);
+
+tgroup_t thrdpool_group_create(tpool_t tp);
+int thrdpool_group_destroy(tgroup_t grp);
+
+/**
+ *  Cancel jobs added to the group with @c cancel unless they have their own.
+ */
+int thrdpool_group_set_cancel(tgroup_t grp, tcancel_t cancel);
+int thrdpool_group_add(tgroup_t grp, job_t *job);
+int thrdpool_group_wait(tgroup_t grp);
+
+/**
+ *  Run @c body over [begin, end) in sub-ranges of at least @c grain items.
+ */
+int thrdpool_parallel_for(tpool_t tp, size_t begin, size_t end, size_t grain,
+                          void (*body)(size_t begin, size_t end, void *arg), void *arg);
+
+/**
+ *  Fold [begin, end) with @c body, partial results are merged with @c join.
+ *  @c join must be associative and commutative, @c identity its neutral value.
+ */
+int thrdpool_parallel_reduce(tpool_t tp, size_t begin, size_t end, size_t grain,
+                             intmax_t identity,
+                             intmax_t (*body)(size_t begin, size_t end, intmax_t acc, void *arg),
+                             intmax_t (*join)(intmax_t lhs, intmax_t rhs, void *arg),
+                             void *arg, intmax_t *result);
+
+tgraph_t thrdpool_graph_create(tpool_t tp);
+int thrdpool_graph_destroy(tgraph_t graph);
+
+/**
+ *  Add a node running a copy of @c job, returns the node index.
+ */
+ssize_t thrdpool_graph_add_node(tgraph_t graph, const job_t *job);
+
+/**
+ *  Make node @c to wait for node @c from.
+ */
+int thrdpool_graph_add_edge(tgraph_t graph, size_t from, size_t to);
+int thrdpool_graph_compile(tgraph_t graph);
+int thrdpool_graph_run(tgraph_t graph);
+
+/**
+ *  Snapshot per-name timings into @c stats, returns the number of names.
+ *  The pool must have been created with profiling enabled.
+ */
+ssize_t thrdpool_job_stats(tpool_t tp, jstats_t *stats, size_t num);
+
+/**
+ *  Upper bound in nanoseconds of the @c percentile (0-100) of @c histo.
+ */
+int64_t thrdpool_histo_percentile(const jhisto_t *histo, double percentile);
+
+/**
+ *  Snapshot per-worker counters and running jobs.
+ */
+int thrdpool_stats(tpool_t tp, tstats_t *stats);
+
 #if defined(__cplusplus)
 }
 #endif
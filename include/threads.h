@@ -22,6 +22,11 @@ extern "C" {
  */
 #define MAX_THREADS (256)
 
+/**
+ *  MAX_CPUS desc.
+ */
+#define MAX_CPUS (8 * sizeof(cpu_set_t))
+
 /**
  *  thrd_t desc.
  */
@@ -107,11 +112,55 @@ int thrd_set_name(thrd_t thr, const char *name);
  */
 int thrd_get_name(thrd_t thr, char *name, size_t len);
 
+/**
+ *  thrd_set_prior summary.
+ */
 int thrd_set_prior(thrd_t thr, int prior);
+
+/**
+ *  thrd_get_prior summary.
+ */
 int thrd_get_prior(thrd_t thr);
+
+/**
+ *  thrd_set_affinity summary.
+ */
 int thrd_set_affinity(thrd_t thr, const cpu_set_t *cpuset);
+
+/**
+ *  thrd_get_affinity summary.
+ */
 int thrd_get_affinity(thrd_t thr, cpu_set_t *cpuset);
 
+/**
+ *  cpu_info desc.
+ */
+struct cpu_info {
+    int cpu;     /**< Logical CPU number. */
+    int package; /**< Package index. */
+    int core;    /**< Core index, unique across packages. */
+    int smt;     /**< Index among the SMT siblings of the core. */
+    int llc;     /**< Last-level cache group index. */
+    int node;    /**< NUMA node index. */
+};
+
+/**
+ *  cpu_topo_t desc.
+ */
+typedef struct cpu_topology {
+    size_t num_cpus;                  /**< Usable logical CPUs. */
+    size_t num_packages;              /**< num_packages desc. */
+    size_t num_cores;                 /**< num_cores desc. */
+    size_t num_llcs;                  /**< num_llcs desc. */
+    size_t num_nodes;                 /**< num_nodes desc. */
+    struct cpu_info cpus[MAX_CPUS];   /**< In CPU number order. */
+} cpu_topo_t;
+
+/**
+ *  thrd_get_topology summary.
+ */
+int thrd_get_topology(cpu_topo_t *topo);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdalign.h>
 #include <stdatomic.h>
 #include <stdint.h>
 #include <inttypes.h>
@@ -31,6 +32,17 @@ struct memory_fragment {
     uint8_t data[];          /**< data desc. */
 };
 
+/**
+ *  memory_segment desc.
+ *
+ *  Extra fragments chained to a growable pool.
+ */
+struct memory_segment {
+    struct memory_segment *next;  /**< next desc. */
+    size_t capacity;              /**< capacity desc. */
+    alignas(16) uint8_t frags[];  /**< frags desc. */
+};
+
 /**
  *  MEMORY_FRAGMENT_MAKER desc.
  *
@@ -57,6 +69,9 @@ struct memory_fragment {
         .pool = (p),               \
         .data_bytes = (b),         \
         .capacity = (c),           \
+        .growable = false,         \
+        .grown = 0,                \
+        .segments = NULL,          \
         .freeable = 0,             \
         .head = {                  \
             .count = 0,            \
@@ -268,6 +283,54 @@ INLINE void internal_mempool_setup(struct memory_pool *self,
 #endif
 }
 
+/**
+ *  internal_mempool_grow desc.
+ *
+ *  Chain a new segment as large as the current capacity,
+ *  and feed its fragments to the free list. Allocators are not blocked.
+ *
+ *  @param  [in,out]    self    self desc.
+ *  @return Returns zero if succeed, -1 if failed.
+ */
+INLINE int internal_mempool_grow(struct memory_pool *self)
+{
+    size_t capacity = self->capacity + atomic_load(&self->grown);
+    size_t frag_bytes = internal_mempool_aligned_data_bytes(self);
+    struct memory_segment *seg = calloc(1, sizeof(*seg) + (frag_bytes * capacity));
+    if (seg == NULL) {
+        return -1;
+    }
+    seg->capacity = capacity;
+
+    seg->next = atomic_load(&self->segments);
+    while (!atomic_compare_exchange_weak(&self->segments, &seg->next, seg)) {
+        /* retry */
+    }
+    atomic_fetch_add(&self->grown, capacity);
+
+    for (size_t i = 0; i < capacity; ++i) {
+        internal_mempool_put(self, (struct memory_fragment *)&seg->frags[frag_bytes * i]);
+    }
+
+    return 0;
+}
+
+/**
+ *  internal_mempool_release_segments desc.
+ *
+ *  @param  [in,out]    self    self desc.
+ */
+INLINE void internal_mempool_release_segments(struct memory_pool *self)
+{
+    struct memory_segment *seg = atomic_exchange(&self->segments, NULL);
+    while (seg != NULL) {
+        struct memory_segment *next = seg->next;
+        free(seg);
+        seg = next;
+    }
+    atomic_store(&self->grown, 0);
+}
+
 /**
  *  @details    mempool_create desc.
  *
@@ -316,6 +379,7 @@ int mempool_destroy(mpool_t *mp)
 
     SELFLIZE(struct memory_pool *, mp);
 
+    internal_mempool_release_segments(self);
     free(self->pool);
     self->pool = NULL;
 
@@ -337,7 +401,31 @@ int mempool_clear(mpool_t *mp)
 
     SELFLIZE(struct memory_pool *, mp);
 
+    bool growable = self->growable;
+    internal_mempool_release_segments(self);
     internal_mempool_setup(self, self->pool, self->data_bytes, self->capacity);
+    self->growable = growable;
+
+    return 0;
+}
+
+/**
+ *  @details    mempool_set_growable desc.
+ *
+ *  @param      [in,out]    mp          mp desc.
+ *  @param      [in]        growable    true to chain more segments when exhausted.
+ *  @return     Returns zero if succeed, -1 if failed.
+ */
+int mempool_set_growable(mpool_t *mp, bool growable)
+{
+    if (mp == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct memory_pool *, mp);
+
+    self->growable = growable;
 
     return 0;
 }
@@ -357,7 +445,14 @@ void *mempool_alloc(mpool_t *mp)
 
     SELFLIZE(struct memory_pool *, mp);
 
-    return internal_mempool_pick(self);
+    struct memory_fragment *frag;
+    while ((frag = internal_mempool_pick(self)) == NULL) {
+        if (!self->growable || (internal_mempool_grow(self) != 0)) {
+            return NULL;
+        }
+    }
+
+    return frag;
 }
 
 /**
@@ -410,7 +505,7 @@ ssize_t mempool_capacity(mpool_t *mp)
 
     SELFLIZE(struct memory_pool *, mp);
 
-    return self->capacity;
+    return self->capacity + atomic_load(&self->grown);
 }
 
 /**
@@ -454,7 +549,18 @@ bool mempool_contains(mpool_t *mp, const void *ptr)
     size_t pool_size = frag_bytes * self->capacity;
 #endif
     void *pool_end = (void *)((uintptr_t)self->pool + pool_size);
-    return (self->pool <= ptr) && (ptr < pool_end);
+    if ((self->pool <= ptr) && (ptr < pool_end)) {
+        return true;
+    }
+
+    for (struct memory_segment *seg = atomic_load(&self->segments); seg != NULL; seg = seg->next) {
+        const void *seg_end = &seg->frags[frag_bytes * seg->capacity];
+        if (((const void *)seg->frags <= ptr) && (ptr < seg_end)) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 /**
@@ -555,6 +661,25 @@ int queue_destroy(que_t *q)
     return 0;
 }
 
+/**
+ *  @details    queue_set_growable desc.
+ *
+ *  @param      [in,out]    q           q desc.
+ *  @param      [in]        growable    true to grow instead of failing when full.
+ *  @return     Returns zero if succeed, -1 if failed.
+ */
+int queue_set_growable(que_t *q, bool growable)
+{
+    if (q == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct queue *, q);
+
+    return mempool_set_growable(&self->pool, growable);
+}
+
 /**
  *  @details    queue_enqueue desc.
  *
@@ -602,6 +727,76 @@ int queue_enqueue(que_t *q, const void *val)
     return 0;
 }
 
+/**
+ *  @details    queue_enqueue_batch desc.
+ *
+ *  Values are linked privately first, then appended with a single
+ *  link CAS and a single tail swing.
+ *
+ *  @param      [in,out]    q       q desc.
+ *  @param      [in]        vals    array of @c num values.
+ *  @param      [in]        num     num desc.
+ *  @return     Returns zero if succeed, -1 if failed.
+ */
+int queue_enqueue_batch(que_t *q, const void *vals, size_t num)
+{
+    if ((q == NULL) || (vals == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (num == 0) {
+        return 0;
+    }
+
+    SELFLIZE(struct queue *, q);
+
+    const uint8_t *src = vals;
+    struct queue_value *first = NULL, *last = NULL;
+    for (size_t i = 0; i < num; ++i) {
+        struct queue_value *v = queue_alloc_value(self, &src[self->val_bytes * i]);
+        if (v == NULL) {
+            while (first != NULL) {
+                struct queue_value *next = first->next.val;
+                mempool_free(&self->pool, first);
+                first = next;
+            }
+            return -1;
+        }
+        if (last == NULL) {
+            first = v;
+        } else {
+            last->next.val = v;
+        }
+        last = v;
+    }
+
+    struct queue_node tail, tmp;
+    while (true) {
+        tail = atomic_load(&self->tail);
+        struct queue_node next = tail.val->next;
+
+        if (equals(tail, self->tail)) {
+            if (next.val == NULL) {
+                tmp.val = first;
+                tmp.count = next.count + 1;
+                if (atomic_compare_exchange_weak(&tail.val->next, &next, tmp)) {
+                    break;
+                }
+            } else {
+                tmp.val = next.val;
+                tmp.count = tail.count + 1;
+                atomic_compare_exchange_weak(&self->tail, &tail, tmp);
+            }
+        }
+    }
+    /* If this fails, other threads advance the tail along the batch. */
+    tmp.val = last;
+    tmp.count = tail.count + 1;
+    atomic_compare_exchange_weak(&self->tail, &tail, tmp);
+
+    return 0;
+}
+
 /**
  *  @details    queue_dequeue desc.
  *
@@ -652,36 +847,417 @@ int queue_dequeue(que_t *q, void *val)
     return 0;
 }
 
+/**
+ *  @details    queue_size desc.
+ *
+ *  @param      [in]    q   q desc.
+ *  @return     Returns approximate number of values if succeed, -1 if failed.
+ */
+ssize_t queue_size(que_t *q)
+{
+    if (q == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct queue *, q);
+
+    /* One node is always held as the dummy. */
+    ssize_t used = mempool_capacity(&self->pool) - mempool_freeable(&self->pool) - 1;
+
+    return (used > 0) ? used : 0;
+}
+
+/**
+ *  deque_array desc.
+ */
+struct deque_array {
+    size_t capacity;          /**< capacity desc. (power of 2) */
+    struct deque_array *prev; /**< prev desc. */
+    uint8_t data[];           /**< data desc. */
+};
+
+/**
+ *  deque_alloc_array desc.
+ *
+ *  @param  [in]    val_bytes   val_bytes desc.
+ *  @param  [in]    capacity    capacity desc.
+ *  @return Returns array object if succeed, NULL if failed.
+ */
+INLINE struct deque_array *deque_alloc_array(size_t val_bytes, size_t capacity)
+{
+    size_t cap = 1;
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+
+    struct deque_array *a = malloc(sizeof(*a) + (val_bytes * cap));
+    if (a == NULL) {
+        return NULL;
+    }
+    a->capacity = cap;
+    a->prev = NULL;
+
+    return a;
+}
+
+/**
+ *  deque_slot desc.
+ *
+ *  @param  [in]    self    self desc.
+ *  @param  [in]    a       a desc.
+ *  @param  [in]    index   index desc.
+ *  @return Returns address of the slot for @c index.
+ */
+static inline void *deque_slot(struct deque *self, struct deque_array *a, ssize_t index)
+{
+    return &a->data[((size_t)index & (a->capacity - 1)) * self->val_bytes];
+}
+
+/**
+ *  @details    deque_create desc.
+ *
+ *  @param      [out]   q           q desc.
+ *  @param      [in]    val_bytes   val_bytes desc.
+ *  @param      [in]    capacity    capacity desc.
+ *  @return     Returns zero if succeed, -1 if failed.
+ */
 int deque_create(deq_t *q, size_t val_bytes, size_t capacity)
 {
-    return -1;
+    if ((q == NULL) || (val_bytes == 0) || (capacity == 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct deque *, q);
+
+    struct deque_array *a = deque_alloc_array(val_bytes, capacity);
+    if (a == NULL) {
+        return -1;
+    }
+    self->val_bytes = val_bytes;
+    self->growable = false;
+    atomic_init(&self->array, a);
+    atomic_init(&self->top, 0);
+    atomic_init(&self->bottom, 0);
+
+    return 0;
 }
 
+/**
+ *  @details    deque_destroy desc.
+ *
+ *  @param      [in,out]    q   q desc.
+ *  @return     Returns zero if succeed, -1 if failed.
+ */
 int deque_destroy(deq_t *q)
 {
-    return -1;
+    if (q == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct deque *, q);
+
+    struct deque_array *a = atomic_load(&self->array);
+    while (a != NULL) {
+        struct deque_array *prev = a->prev;
+        free(a);
+        a = prev;
+    }
+    atomic_store(&self->array, NULL);
+
+    return 0;
+}
+
+/**
+ *  @details    deque_set_growable desc.
+ *
+ *  @param      [in,out]    q           q desc.
+ *  @param      [in]        growable    true to grow instead of failing when full.
+ *  @return     Returns zero if succeed, -1 if failed.
+ */
+int deque_set_growable(deq_t *q, bool growable)
+{
+    if (q == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct deque *, q);
+
+    self->growable = growable;
+
+    return 0;
+}
+
+/**
+ *  deque_grow desc.
+ *
+ *  Double the array, old ones are kept until destroyed
+ *  since thieves may still read from them.
+ *
+ *  @param  [in,out]    self    self desc.
+ *  @param  [in]        a       a desc.
+ *  @param  [in]        t       t desc.
+ *  @param  [in]        b       b desc.
+ *  @return Returns new array if succeed, NULL if failed.
+ */
+INLINE struct deque_array *deque_grow(struct deque *self, struct deque_array *a, ssize_t t, ssize_t b)
+{
+    struct deque_array *na = deque_alloc_array(self->val_bytes, a->capacity * 2);
+    if (na == NULL) {
+        return NULL;
+    }
+    for (ssize_t i = t; i < b; ++i) {
+        memcpy(deque_slot(self, na, i), deque_slot(self, a, i), self->val_bytes);
+    }
+    na->prev = a;
+    atomic_store_explicit(&self->array, na, memory_order_release);
+
+    return na;
 }
 
+/**
+ *  @details    deque_push desc.
+ *
+ *  @param      [in,out]    q   q desc.
+ *  @param      [in]        val val desc.
+ *  @return     Returns zero if succeed, -1 if failed.
+ *  @note       Only the owner thread may call.
+ */
 int deque_push(deq_t *q, const void *val)
 {
-    return -1;
+    if ((q == NULL) || (val == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct deque *, q);
+
+    ssize_t b = atomic_load_explicit(&self->bottom, memory_order_relaxed);
+    ssize_t t = atomic_load_explicit(&self->top, memory_order_acquire);
+    struct deque_array *a = atomic_load_explicit(&self->array, memory_order_relaxed);
+    if ((size_t)(b - t) >= a->capacity) {
+        if (!self->growable) {
+            errno = ENOMEM;
+            return -1;
+        }
+        a = deque_grow(self, a, t, b);
+        if (a == NULL) {
+            return -1;
+        }
+    }
+    memcpy(deque_slot(self, a, b), val, self->val_bytes);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&self->bottom, b + 1, memory_order_relaxed);
+
+    return 0;
+}
+
+/**
+ *  @details    deque_push_batch desc.
+ *
+ *  @param      [in,out]    q       q desc.
+ *  @param      [in]        vals    array of @c num values.
+ *  @param      [in]        num     num desc.
+ *  @return     Returns zero if succeed, -1 if failed.
+ *  @note       Only the owner thread may call.
+ */
+int deque_push_batch(deq_t *q, const void *vals, size_t num)
+{
+    if ((q == NULL) || (vals == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct deque *, q);
+
+    ssize_t b = atomic_load_explicit(&self->bottom, memory_order_relaxed);
+    ssize_t t = atomic_load_explicit(&self->top, memory_order_acquire);
+    struct deque_array *a = atomic_load_explicit(&self->array, memory_order_relaxed);
+    while ((size_t)(b - t) + num > a->capacity) {
+        if (!self->growable) {
+            errno = ENOMEM;
+            return -1;
+        }
+        a = deque_grow(self, a, t, b);
+        if (a == NULL) {
+            return -1;
+        }
+    }
+    const uint8_t *src = vals;
+    for (size_t i = 0; i < num; ++i) {
+        memcpy(deque_slot(self, a, b + i), &src[self->val_bytes * i], self->val_bytes);
+    }
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&self->bottom, b + num, memory_order_relaxed);
+
+    return 0;
 }
 
+/**
+ *  @details    deque_pop desc.
+ *
+ *  @param      [in,out]    q   q desc.
+ *  @param      [out]       val val desc.
+ *  @return     Returns zero if succeed, -1 if failed.
+ *  @note       Only the owner thread may call.
+ */
 int deque_pop(deq_t *q, void *val)
 {
-    return -1;
+    if (q == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct deque *, q);
+
+    ssize_t b = atomic_load_explicit(&self->bottom, memory_order_relaxed) - 1;
+    struct deque_array *a = atomic_load_explicit(&self->array, memory_order_relaxed);
+    atomic_store_explicit(&self->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    ssize_t t = atomic_load_explicit(&self->top, memory_order_relaxed);
+
+    if (t > b) {
+        atomic_store_explicit(&self->bottom, b + 1, memory_order_relaxed);
+        errno = ENOENT;
+        return -1;
+    }
+    if (val != NULL) {
+        memcpy(val, deque_slot(self, a, b), self->val_bytes);
+    }
+    if (t == b) {
+        /* Last one, race against thieves. */
+        bool won = atomic_compare_exchange_strong_explicit(&self->top, &t, t + 1,
+                                                           memory_order_seq_cst,
+                                                           memory_order_relaxed);
+        atomic_store_explicit(&self->bottom, b + 1, memory_order_relaxed);
+        if (!won) {
+            errno = ENOENT;
+            return -1;
+        }
+    }
+
+    return 0;
 }
 
-int deque_shift(deq_t *q, const void *val)
+/**
+ *  @details    deque_shift desc.
+ *
+ *  @param      [in,out]    q   q desc.
+ *  @param      [out]       val val desc.
+ *  @return     Returns zero if succeed, -1 if failed.
+ *              errno is set to ENOENT if empty, EAGAIN if lost the race.
+ */
+int deque_shift(deq_t *q, void *val)
 {
-    return -1;
+    if (q == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct deque *, q);
+
+    ssize_t t = atomic_load_explicit(&self->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    ssize_t b = atomic_load_explicit(&self->bottom, memory_order_acquire);
+    if (t >= b) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    struct deque_array *a = atomic_load_explicit(&self->array, memory_order_acquire);
+    if (val != NULL) {
+        memcpy(val, deque_slot(self, a, t), self->val_bytes);
+    }
+    if (!atomic_compare_exchange_strong_explicit(&self->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ *  @details    deque_shift_batch desc.
+ *
+ *  Steal half of the values, rounded up, but at most @c num.
+ *  Values are claimed one CAS at a time: a single CAS over several
+ *  slots could pass the owner, who pops without one until the last value.
+ *
+ *  @param      [in,out]    q       q desc.
+ *  @param      [out]       vals    array of @c num values.
+ *  @param      [in]        num     num desc.
+ *  @return     Returns number of values taken if succeed, -1 if failed.
+ *              errno is set to ENOENT if empty, EAGAIN if lost the race.
+ */
+ssize_t deque_shift_batch(deq_t *q, void *vals, size_t num)
+{
+    if ((q == NULL) || (vals == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct deque *, q);
+
+    ssize_t half = (deque_size(q) + 1) / 2;
+    size_t limit = ((half > 0) && ((size_t)half < num)) ? (size_t)half : num;
+    uint8_t *dst = vals;
+    size_t taken = 0;
+    while (taken < limit) {
+        if (deque_shift(q, &dst[self->val_bytes * taken]) != 0) {
+            break;
+        }
+        ++taken;
+    }
+    if ((taken == 0) && (limit > 0)) {
+        return -1;
+    }
+
+    return (ssize_t)taken;
 }
 
-int deque_unshift(deq_t *q, void *val)
+/**
+ *  @details    deque_unshift desc.
+ *
+ *  @param      [in,out]    q   q desc.
+ *  @param      [in]        val val desc.
+ *  @return     Always returns -1, a work-stealing deque has no way to
+ *              insert at the top.
+ */
+int deque_unshift(deq_t *q, const void *val)
 {
+    UNUSED_VARIABLE(q);
+    UNUSED_VARIABLE(val);
+
+    errno = ENOTSUP;
     return -1;
 }
 
+/**
+ *  @details    deque_size desc.
+ *
+ *  @param      [in]    q   q desc.
+ *  @return     Returns approximate number of values if succeed, -1 if failed.
+ */
+ssize_t deque_size(deq_t *q)
+{
+    if (q == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct deque *, q);
+
+    ssize_t b = atomic_load_explicit(&self->bottom, memory_order_relaxed);
+    ssize_t t = atomic_load_explicit(&self->top, memory_order_relaxed);
+
+    return (b > t) ? (b - t) : 0;
+}
+
 enum {
     MARKED = 0x00000001,      /**< MARKED desc. */
     UNMARKED = 0x00000000,    /**< UNMARKED desc. */
@@ -26,6 +26,7 @@ extern "C" {
 #define MEMPOOL_IMPLEMENTED_QUEUE
 
 struct memory_fragment;
+struct memory_segment;
 
 /**
  *  memory_node desc.
@@ -42,6 +43,9 @@ typedef struct memory_pool {
     void *pool;                                   /**< pool desc. */
     size_t data_bytes;                            /**< data_bytes desc. */
     size_t capacity;                              /**< capacity desc. */
+    bool growable;                                /**< growable desc. */
+    _Atomic(size_t) grown;                        /**< capacity added by growth. */
+    _Atomic(struct memory_segment *) segments;    /**< segments desc. */
     _Atomic(size_t) freeable;                     /**< freeable desc. */
     alignas(16) _Atomic(struct memory_node) head; /**< head desc. */
     alignas(16) _Atomic(struct memory_node) tail; /**< tail desc. */
@@ -55,6 +59,9 @@ typedef struct memory_pool {
         .pool = NULL,           \
         .data_bytes = 0,        \
         .capacity = 0,          \
+        .growable = false,      \
+        .grown = 0,             \
+        .segments = NULL,       \
         .freeable = 0,          \
         .head = {               \
             .count = 0,         \
@@ -81,6 +88,11 @@ int mempool_destroy(mpool_t *mp);
  */
 int mempool_clear(mpool_t *mp);
 
+/**
+ *  mempool_set_growable summary.
+ */
+int mempool_set_growable(mpool_t *mp, bool growable);
+
 /**
  *  mempool_alloc summary.
  */
@@ -141,25 +153,97 @@ int queue_create(que_t *q, size_t val_bytes, size_t capacity);
  */
 int queue_destroy(que_t *q);
 
+/**
+ *  queue_set_growable summary.
+ */
+int queue_set_growable(que_t *q, bool growable);
+
 /**
  *  queue_enqueue summary.
  */
 int queue_enqueue(que_t *q, const void *val);
 
+/**
+ *  queue_enqueue_batch summary.
+ */
+int queue_enqueue_batch(que_t *q, const void *vals, size_t num);
+
 /**
  *  queue_dequeue summary.
  */
 int queue_dequeue(que_t *q, void *val);
 
+/**
+ *  queue_size summary.
+ */
+ssize_t queue_size(que_t *q);
+
+struct deque_array;
+
+/**
+ *  deque desc.
+ *
+ *  Work-stealing deque (Chase-Lev, with the C11 orderings of Le et al.).
+ *  Only the owner thread may push / pop at the bottom,
+ *  any thread may shift (steal) from the top.
+ */
 typedef struct deque {
+    size_t val_bytes;                        /**< val_bytes desc. */
+    bool growable;                           /**< growable desc. */
+    _Atomic(struct deque_array *) array;     /**< array desc. */
+    alignas(64) _Atomic(ssize_t) top;        /**< top desc. */
+    alignas(64) _Atomic(ssize_t) bottom;     /**< bottom desc. */
 } deq_t;
 
+/**
+ *  deque_create summary.
+ */
 int deque_create(deq_t *q, size_t val_bytes, size_t capacity);
+
+/**
+ *  deque_destroy summary.
+ */
 int deque_destroy(deq_t *q);
+
+/**
+ *  deque_set_growable summary.
+ */
+int deque_set_growable(deq_t *q, bool growable);
+
+/**
+ *  deque_push summary.
+ */
 int deque_push(deq_t *q, const void *val);
+
+/**
+ *  deque_push_batch summary.
+ */
+int deque_push_batch(deq_t *q, const void *vals, size_t num);
+
+/**
+ *  deque_pop summary.
+ */
 int deque_pop(deq_t *q, void *val);
-int deque_shift(deq_t *q, const void *val);
-int deque_unshift(deq_t *q, void *val);
+
+/**
+ *  deque_shift summary.
+ */
+int deque_shift(deq_t *q, void *val);
+
+/**
+ *  deque_shift_batch summary.
+ */
+ssize_t deque_shift_batch(deq_t *q, void *vals, size_t num);
+
+/**
+ *  deque_unshift summary.
+ */
+int deque_unshift(deq_t *q, const void *val);
+
+/**
+ *  deque_size summary.
+ */
+ssize_t deque_size(deq_t *q);
 
 /**
  *  lkey_t desc.
@@ -15,11 +15,16 @@
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <stdint.h>
+#include <stdalign.h>
 #include <inttypes.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <limits.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "utils.h"
 #include "collections.h"
@@ -29,62 +34,436 @@
 #include "thread_pool.h"
 
 #define MAX_JOBS (32)
+#define IDLE_MASK_BITS (64)
+#define IDLE_MASK_WORDS ((MAX_THREADS + IDLE_MASK_BITS - 1) / IDLE_MASK_BITS)
+#define TIMER_TICK_NS (1000000)
+#define TIMER_WHEEL_BITS (6)
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS (4)
+#define TIMER_BATCH (32)
+#define HISTO_SUB_BITS (3)
+#define HISTO_SUB_BUCKETS (1 << HISTO_SUB_BITS)
+#define HISTO_MAX_BITS (40)
+#define PROFILE_NAMES (32)
+#define CANCEL_TAG_BUCKETS (64)
+#define IDLE_SPIN_MIN_NS (1000)
+#define IDLE_SPIN_MAX_NS (50000)
+#define IDLE_YIELDS (2)
+#define NAME_SLOTS (1 << 16)
+#define NAME_CHUNK_BITS (8)
+#define NAME_CHUNK_SIZE (1 << NAME_CHUNK_BITS)
+#define NAMES_MAX (NAME_SLOTS / 2)
+#define ENTRY_BATCH (64)
+#define ENTRY_INLINE_MAX (24) /* Inline argument bytes a job_entry carries, larger ones are boxed. */
+#define STEAL_BATCH (16)
+#define PRIORITY_AGING (16)
+#define TENANT_QUANTUM_NS (100000) /* Run time a round grants per unit of weight. */
+#define EDF_EMPTY (INT64_MAX)
+#define EDF_NONE (INT64_MAX - 1)
 
 enum worker_state {
     INIT,
     IDLE,
     WORKING,
     FAIL,
+    RETIRING,
+    STOPPING,
 };
 
 #define JOB_MAKER(f, a)    \
     (job_t){               \
         .id = 0,           \
-        .start_time = 0,   \
-        .end_time = 0,     \
+        .name = 0,         \
+        .waitable = false, \
+        .inline_size = 0,  \
+        .inlined = false,  \
+        .priority = THRDPOOL_PRIO_NORMAL, \
+        .deadline = 0,     \
+        .cancel = NULL,    \
+        .tag = 0,          \
+        .tenant = NULL,    \
         .func = (f),       \
         .arg = (a),        \
-        .name = {0},       \
-        .waitable = false, \
+        .dtor = NULL,      \
+        .handle = {0},     \
+        .group = NULL,     \
+        .timer = {0},      \
     }
 
+enum job_record_state {
+    PENDING,
+    DONE,
+    DETACHED,
+};
+
+/**
+ *  Pooled completion record behind a #jhandle_t.
+ */
+struct job_record {
+    promise_t prms;
+    future_t *ftr;
+    mpool_t *pool;
+    int64_t start_time;
+    int64_t end_time;
+    struct thread_pool_group *group; /* Of the job, completed after the record. */
+    struct thread_pool_cancel *cancel; /* Holds a reference. */
+    _Atomic(int) state;
+    _Atomic(uint32_t) gen; /* Kept last, survives the pool's free-list link. */
+};
+
+enum job_entry_carry {
+    CARRY_POINTER, /* @c arg is the caller's. */
+    CARRY_INLINE,  /* The argument is @c data. */
+    CARRY_BOXED,   /* @c arg is a pooled copy, freed with the entry. */
+};
+
+/**
+ *  What the queues carry for a job, one cache line per hop.
+ */
+struct job_entry {
+    int (*func)(void *);
+    union {
+        void *arg;
+        uint64_t data[ENTRY_INLINE_MAX / sizeof(uint64_t)];
+    };
+    void (*dtor)(void *);
+    void *done; /* The job_record if any, else the group or NULL. */
+    int64_t submit_time;
+    juid_t id;
+    uint16_t name;
+    uint8_t carry; /* enum job_entry_carry */
+    bool waitable; /* @c done is a job_record, also set for cancellable jobs. */
+};
+
+_Static_assert(sizeof(struct job_entry) <= 64, "job_entry must fit in a cache line");
+
+/**
+ *  Interned job names, shared by every pool of the process.
+ *
+ *  Names are never removed, so a name string stays valid once its ID
+ *  has been handed out, and lookups by ID take no lock.
+ */
+struct name_table {
+    pthread_mutex_t lock;
+    size_t num_names;
+    _Atomic(uint16_t) slots[NAME_SLOTS]; /* Open addressing by name hash, zero if free. */
+    _Atomic(char (*)[JOB_NAME_MAX]) chunks[NAMES_MAX / NAME_CHUNK_SIZE];
+};
+
+struct thread_pool;
+
+/**
+ *  Cancellation token, shared by the jobs it governs.
+ */
+struct thread_pool_cancel {
+    _Atomic(bool) requested;
+    _Atomic(size_t) refs;
+    struct thread_pool *pool; /* Tag table it is listed in, NULL if not a tag. */
+    uint32_t tag;
+    struct thread_pool_cancel *next; /* In the tag table. */
+};
+
+/**
+ *  Tenant queue, scheduled by deficit round-robin with the others.
+ */
+struct thread_pool_tenant {
+    struct thread_pool *pool;
+    que_t *jobs; /* @c queue, or the pool's normal queue for the default tenant. */
+    que_t queue;
+    _Atomic(uint32_t) weight;
+    _Atomic(size_t) depth;
+    size_t index; /* In the pool's tenants and every worker's deficits. */
+    uint64_t bit; /* In the pool's tenants_busy mask, zero for the default tenant. */
+    _Atomic(uint64_t) served;
+    _Atomic(uint64_t) served_time;
+};
+
+/**
+ *  Fork-join group, counts jobs not yet finished.
+ */
+struct thread_pool_group {
+    struct thread_pool *pool;
+    struct thread_pool_cancel *cancel; /* Holds a reference. */
+    _Atomic(size_t) pending;
+    _Atomic(uint32_t) done; /* futex word, bumped when pending drops to zero. */
+};
+
+/**
+ *  Shared state of one parallel_for / parallel_reduce call.
+ */
+struct parallel_ctx {
+    struct thread_pool_group *grp;
+    size_t grain;
+    void (*for_body)(size_t, size_t, void *);
+    intmax_t (*reduce_body)(size_t, size_t, intmax_t, void *);
+    intmax_t (*join)(intmax_t, intmax_t, void *);
+    intmax_t identity;
+    void *arg;
+    _Atomic(intmax_t) result;
+};
+
+/**
+ *  A sub-range waiting to be run or stolen, carried inline by its job.
+ */
+struct parallel_range {
+    struct parallel_ctx *pc;
+    size_t begin;
+    size_t end;
+};
+
+/**
+ *  Node of a task graph, successors are a slice of the graph's CSR array.
+ */
+struct graph_node {
+    struct thread_pool_graph *graph;
+    job_t job;
+    size_t num_preds;
+    size_t first_succ;
+    size_t num_succs;
+    _Atomic(size_t) remaining; /* Predecessors not yet finished in this run. */
+};
+
+struct graph_edge {
+    size_t from;
+    size_t to;
+};
+
+/**
+ *  Reusable dependency graph, compiled once and run many times.
+ */
+struct thread_pool_graph {
+    struct thread_pool *pool;
+    struct thread_pool_group *grp;
+    struct graph_node *nodes;
+    size_t num_nodes;
+    size_t cap_nodes;
+    struct graph_edge *edges;
+    size_t num_edges;
+    size_t cap_edges;
+    size_t *succs;
+    job_t *roots;
+    size_t num_roots;
+    bool compiled;
+    _Atomic(bool) running;
+};
+
+struct timer_wheel;
+
+/**
+ *  Pending delayed or periodic job, linked into one wheel slot.
+ */
+struct thread_pool_timer {
+    job_t job;
+    struct timer_wheel *wheel;
+    uint64_t expires; /* tick */
+    uint64_t period;  /* ticks, zero for one-shot. */
+    struct thread_pool_timer **slot;
+    struct thread_pool_timer *prev;
+    struct thread_pool_timer *next;
+    _Atomic(uint32_t) gen; /* Kept last, survives the pool's free-list link. */
+};
+
+/**
+ *  Hierarchical timing wheel, 1 ms ticks and 64 slots per level.
+ */
+struct timer_wheel {
+    pthread_mutex_t lock;
+    mpool_t entries;
+    uint64_t current;     /* Next tick to process. */
+    uint64_t sleep_until; /* Tick the timer thread is sleeping towards. */
+    int64_t epoch;
+    size_t num_timers;
+    bool started;
+    thrd_t thr;
+    _Atomic(uint32_t) wakeup; /* futex word */
+    struct thread_pool_timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+/**
+ *  Watches blocked workers and makes up for those blocked too long.
+ */
+struct blocking_monitor {
+    pthread_mutex_t lock;
+    int64_t threshold; /* ns, zero if compensation is off. */
+    size_t max_spare;
+    _Atomic(bool) started;
+    bool closed; /* Stopped for good, not to be restarted. */
+    thrd_t thr;
+    _Atomic(uint32_t) wakeup; /* futex word */
+    _Atomic(uint64_t) compensations;
+};
+
+/**
+ *  Log-linear histogram, written by its owning worker only.
+ */
+struct job_histo {
+    _Atomic(uint64_t) count;
+    _Atomic(uint64_t) total;
+    _Atomic(uint64_t) max;
+    _Atomic(uint64_t) buckets[THRDPOOL_HISTO_BUCKETS];
+};
+
+/**
+ *  Per-name timings of one worker.
+ */
+struct job_profile {
+    uint16_t name;
+    _Atomic(bool) used;
+    struct job_histo wait;
+    struct job_histo run;
+};
+
+/**
+ *  Counters written by their worker only.
+ */
+struct worker_counters {
+    _Atomic(uint64_t) executed;
+    _Atomic(uint64_t) stolen;
+    _Atomic(uint64_t) steal_failures;
+    _Atomic(uint64_t) parks;
+    _Atomic(uint64_t) unparks;
+    _Atomic(uint64_t) idle_time;
+    _Atomic(uint64_t) expired;
+    _Atomic(uint64_t) cancelled;
+    _Atomic(uint64_t) stolen_from[MAX_THREADS];
+};
+
+/**
+ *  Seqlock-published copy of the job a worker is running.
+ */
+struct job_view {
+    _Atomic(uint32_t) seq; /* Odd while being written. */
+    _Atomic(bool) running;
+    _Atomic(juid_t) id;
+    _Atomic(uint16_t) name;
+};
+
+/**
+ *  A queued job in deadline mode.
+ */
+struct edf_item {
+    int64_t deadline; /* EDF_NONE if the job has none. */
+    struct job_entry entry;
+};
+
+/**
+ *  Binary min-heap of queued jobs by deadline, then by job ID.
+ */
+struct edf_shard {
+    pthread_mutex_t lock;
+    struct edf_item *items;
+    size_t num;
+    size_t capacity;
+    bool growable;
+    _Atomic(int64_t) head; /* Earliest queued deadline, EDF_EMPTY if none. */
+    _Atomic(size_t) depth;
+    _Atomic(uint64_t) *busy; /* Word of the pool's edf_busy mask holding @c bit. */
+    uint64_t bit;
+};
+
 struct worker {
     thrd_t thr;
     pid_t wid;
-    enum worker_state status;
+    int cpu; /* Pinned CPU, -1 if not pinned to a single CPU. */
+    char name[32];
+    _Atomic(enum worker_state) status;
+    struct thread_pool *pool;
     struct worker *colleagues;
     que_t *global_jobs;
-    pthread_mutex_t *mtx;
-    pthread_cond_t *cnd;
     _Atomic(size_t) *num_active;
-    _Atomic(size_t) *num_local_jobs;
-    que_t local_jobs;
-    job_t job;
+    _Atomic(size_t) *num_idle;
+    _Atomic(uint32_t) wakeup; /* futex word, set by the waker. */
+    deq_t local_jobs[THRDPOOL_PRIORITIES];
+    uint8_t passed[THRDPOOL_PRIORITIES]; /* Jobs picked from higher levels since the level was served. */
+    struct edf_shard edf; /* Used in deadline mode instead of local_jobs. */
+    int64_t deadline; /* Of the running job in deadline mode, inherited by jobs it adds. */
+    int64_t picked; /* Deadline of the job just found by job_seeking(). */
+    struct thread_pool_cancel *cancel; /* Of the running job, NULL if none. */
+    struct thread_pool_tenant *picked_tenant; /* Of the job just found by job_seeking(). */
+    size_t drr_next; /* Tenant this worker is serving. */
+    int64_t deficits[THRDPOOL_MAX_TENANTS + 1]; /* Run time left in this round per tenant, ns. */
+    struct job_entry *current; /* Innermost running job, NULL when idle. */
+    int64_t spin_ns; /* How long to spin before yielding, adapted to job arrivals. */
+    uint32_t rng; /* xorshift32 state for victim selection. */
+    int last_victim; /* Colleague that last had work to steal, -1 if none. */
+    int blocking; /* Nesting of thrdpool_blocking_begin(). */
+    _Atomic(int64_t) blocked_since; /* Zero unless blocking. */
+    struct job_profile *profiles; /* PROFILE_NAMES + 1 entries, NULL unless profiling. */
+    alignas(64) struct job_view view;
+    struct worker_counters counters;
 };
 
 #define WORKER_MAKER(i, o)            \
     (struct worker){                  \
         .wid = (i),                   \
+        .cpu = -1,                    \
         .status = INIT,               \
+        .pool = (o),                  \
         .colleagues = (o)->workers,   \
-        .global_jobs = &(o)->jobs,    \
-        .mtx = &(o)->seek_mtx,        \
-        .cnd = &(o)->seek_cnd,        \
+        .global_jobs = (o)->jobs,     \
         .num_active = &(o)->num_active, \
-        .num_local_jobs = &(o)->num_local_jobs, \
-        .job = JOB_MAKER(NULL, NULL), \
+        .num_idle = &(o)->num_idle,     \
+        .wakeup = ATOMIC_VAR_INIT(0), \
+        .current = NULL,              \
+        .spin_ns = IDLE_SPIN_MIN_NS,  \
+        .rng = ((uint32_t)(i) + 1) * UINT32_C(2654435761), \
+        .last_victim = -1,            \
+        .blocking = 0,                \
+        .blocked_since = ATOMIC_VAR_INIT(0), \
+        .deadline = EDF_NONE,         \
+        .picked = EDF_NONE,           \
+        .cancel = NULL,               \
+        .picked_tenant = NULL,        \
+        .drr_next = 0,                \
+        .profiles = NULL,             \
     }
 
 struct thread_pool {
-    size_t num_workers;
+    size_t num_workers; /* Worker slots, the maximum if elastic. */
+    size_t min_workers;
+    size_t max_workers; /* Elastic bound, the slots above are compensation spares. */
+    size_t grow_threshold;
+    int64_t idle_timeout; /* ns */
+    bool profiling;
+    bool busy_poll;
+    bool thread_names;
+    bool edf; /* Deadline mode. */
+    bool drop_expired;
+    _Atomic(size_t) edf_next; /* Shard for jobs added from outside the pool. */
+    _Atomic(uint64_t) edf_busy[IDLE_MASK_WORDS]; /* Shards with queued jobs. */
+    pthread_mutex_t tags_lock;
+    struct thread_pool_cancel *tags[CANCEL_TAG_BUCKETS]; /* Live tag tokens, unreferenced. */
+    size_t steal_max; /* Jobs taken per steal, fits in an empty local deque. */
+    size_t capacity; /* Of every queue, for tenants added later. */
+    bool growable;
+    enum thrdpool_placement placement;
+    cpu_set_t cpuset;
     atomic_flag initialized;
     promise_t prms;
     future_t *ftr;
-    que_t jobs;
-    pthread_mutex_t seek_mtx;
-    pthread_cond_t seek_cnd;
+    que_t jobs[THRDPOOL_PRIORITIES];
+    _Atomic(unsigned int) levels; /* Levels that have ever had jobs, the others are not searched. */
+    pthread_mutex_t tenants_lock; /* Serializes adding tenants. */
+    _Atomic(size_t) num_tenants; /* The default tenant alone leaves fair scheduling off. */
+    _Atomic(uint64_t) tenants_busy; /* Tenants other than the default one with queued jobs. */
+    struct thread_pool_tenant *tenants[THRDPOOL_MAX_TENANTS + 1]; /* [0] is the default tenant. */
+    struct thread_pool_tenant default_tenant; /* Of jobs added without one. */
+    mpool_t records;
+    mpool_t groups;
+    mpool_t payloads; /* Boxed inline arguments, JOB_INLINE_MAX bytes each. */
     _Atomic(size_t) num_active;
-    _Atomic(size_t) num_local_jobs;
+    _Atomic(size_t) num_idle;
+    _Atomic(size_t) num_spinning;
+    _Atomic(size_t) num_alive;
+    _Atomic(size_t) num_pending; /* Queued or running jobs. */
+    _Atomic(size_t) idle_waiters;
+    _Atomic(uint32_t) idle_seq; /* futex word, bumped when num_pending drops to zero. */
+    _Atomic(bool) closing; /* No more jobs from outside the pool. */
+    _Atomic(bool) stopping;
+    _Atomic(uint64_t) idle_mask[IDLE_MASK_WORDS];
+    _Atomic(size_t) num_blocked;
+    struct blocking_monitor monitor;
+    struct timer_wheel timers;
     struct worker workers[];
 };
 
@@ -94,231 +473,3881 @@ struct thread_pool {
         .initialized = ATOMIC_FLAG_INIT,       \
         .prms = PROMISE_INITIALIZER,           \
         .ftr = NULL,                           \
-        .seek_mtx = PTHREAD_MUTEX_INITIALIZER, \
-        .seek_cnd = PTHREAD_COND_INITIALIZER,  \
         .num_active = ATOMIC_VAR_INIT(0),      \
-        .num_local_jobs = ATOMIC_VAR_INIT(0),  \
+        .num_idle = ATOMIC_VAR_INIT(0),        \
+        .num_spinning = ATOMIC_VAR_INIT(0),    \
+        .num_alive = ATOMIC_VAR_INIT(0),       \
+        .num_pending = ATOMIC_VAR_INIT(0),     \
+        .levels = ATOMIC_VAR_INIT(1u << THRDPOOL_PRIO_NORMAL), \
+        .tenants_lock = PTHREAD_MUTEX_INITIALIZER, \
+        .num_tenants = ATOMIC_VAR_INIT(1),     \
+        .tenants_busy = ATOMIC_VAR_INIT(0),    \
+        .tenants = {NULL},                     \
+        .edf_next = ATOMIC_VAR_INIT(0),        \
+        .edf_busy = {0},                       \
+        .tags_lock = PTHREAD_MUTEX_INITIALIZER, \
+        .tags = {NULL},                        \
+        .idle_waiters = ATOMIC_VAR_INIT(0),    \
+        .idle_seq = ATOMIC_VAR_INIT(0),        \
+        .closing = ATOMIC_VAR_INIT(false),     \
+        .stopping = ATOMIC_VAR_INIT(false),    \
+        .idle_mask = {0},                      \
+        .num_blocked = ATOMIC_VAR_INIT(0),     \
+        .monitor = {.lock = PTHREAD_MUTEX_INITIALIZER}, \
     }
 
 static _Thread_local struct worker *ctx = NULL;
 
-int thrdpool_job_init(job_t *job, int (*func)(void *), void *arg)
+/* Name of the running job, left global for debuggers. */
+_Thread_local const char *thrdpool_job_label = NULL;
+
+static struct name_table names = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static _Atomic(juid_t) juid = ATOMIC_VAR_INIT(0);
+
+static inline int64_t now_ns(void)
 {
-    if ((job == NULL) || (func == NULL)) {
-        errno = EINVAL;
-        return -1;
-    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
 
-    *job = JOB_MAKER(func, arg);
+static inline void relaxed_add(_Atomic(uint64_t) *counter, uint64_t value)
+{
+    /* Single writer, a plain load and store is enough. */
+    atomic_store_explicit(counter,
+                          atomic_load_explicit(counter, memory_order_relaxed) + value,
+                          memory_order_relaxed);
+}
 
-    return 0;
+static inline void cancel_ref(struct thread_pool_cancel *cancel)
+{
+    atomic_fetch_add_explicit(&cancel->refs, 1, memory_order_relaxed);
 }
 
-int thrdpool_job_set_name(job_t *job, const char *name)
+STATIC void cancel_unref(struct thread_pool_cancel *cancel)
 {
-    if ((job == NULL) || (job->func == NULL) || (name == NULL)) {
-        errno = EINVAL;
-        return -1;
+    if ((cancel == NULL) || (atomic_fetch_sub(&cancel->refs, 1) != 1)) {
+        return;
     }
 
-    strncpy(job->name, name, sizeof(job->name) - 1);
-
-    return 0;
+    struct thread_pool *pool = cancel->pool;
+    if (pool != NULL) {
+        /* Unless thrdpool_cancel_tag() or a newer token has unlinked it already. */
+        pthread_mutex_lock(&pool->tags_lock);
+        struct thread_pool_cancel **link = &pool->tags[cancel->tag % CANCEL_TAG_BUCKETS];
+        while ((*link != NULL) && (*link != cancel)) {
+            link = &(*link)->next;
+        }
+        if (*link != NULL) {
+            *link = cancel->next;
+        }
+        pthread_mutex_unlock(&pool->tags_lock);
+    }
+    free(cancel);
 }
 
-int thrdpool_job_set_waitable(job_t *job, bool waitable)
+STATIC struct thread_pool_cancel *cancel_alloc(void)
 {
-    if ((job == NULL) || (job->func == NULL)) {
-        errno = EINVAL;
-        return -1;
+    struct thread_pool_cancel *cancel = malloc(sizeof(*cancel));
+    if (cancel == NULL) {
+        return NULL;
     }
+    atomic_init(&cancel->requested, false);
+    atomic_init(&cancel->refs, 1);
+    cancel->pool = NULL;
+    cancel->tag = 0;
+    cancel->next = NULL;
 
-    job->waitable = waitable;
-
-    return 0;
+    return cancel;
 }
 
-STATIC int work_steal(struct worker *self, job_t *job)
+/**
+ *  Token of @c tag with a reference for the caller, created if the tag
+ *  has none alive.
+ */
+STATIC struct thread_pool_cancel *cancel_tag_get(struct thread_pool *self, uint32_t tag)
 {
-    for (int i = 0; self->colleagues[i].wid != -1; ++i) {
-        struct worker *victim = &self->colleagues[i];
-        if (!thrd_equal(victim->thr, self->thr)) {
-            if (queue_dequeue(&victim->local_jobs, job) == 0) {
-                return 0;
+    pthread_mutex_lock(&self->tags_lock);
+    struct thread_pool_cancel **head = &self->tags[tag % CANCEL_TAG_BUCKETS];
+    for (struct thread_pool_cancel **link = head; *link != NULL; link = &(*link)->next) {
+        struct thread_pool_cancel *cancel = *link;
+        if (cancel->tag != tag) {
+            continue;
+        }
+        size_t refs = atomic_load(&cancel->refs);
+        while (refs > 0) {
+            if (atomic_compare_exchange_weak(&cancel->refs, &refs, refs + 1)) {
+                pthread_mutex_unlock(&self->tags_lock);
+                return cancel;
             }
         }
+        /* Dying, its last owner will find it gone. */
+        *link = cancel->next;
+        break;
     }
 
-    errno = ENOENT;
-    return -1;
+    struct thread_pool_cancel *cancel = cancel_alloc();
+    if (cancel != NULL) {
+        cancel->pool = self;
+        cancel->tag = tag;
+        cancel->next = *head;
+        *head = cancel;
+    }
+    pthread_mutex_unlock(&self->tags_lock);
+
+    return cancel;
 }
 
-STATIC int job_seeking(struct worker *self, job_t *job)
+/**
+ *  Attach a completion record to a waitable or cancellable job.
+ *
+ *  A cancellable job that is not waitable gets a detached record, which
+ *  only carries the token and is freed once the job is done.
+ */
+STATIC int job_record_acquire(struct thread_pool *self, job_t *job)
 {
-    if (atomic_load(self->num_local_jobs) > 0) {
-        if ((queue_dequeue(&self->local_jobs, job) == 0) || (work_steal(self, job) == 0)) {
-            atomic_fetch_sub(self->num_local_jobs, 1);
-            return 0;
+    job->handle = (jhandle_t){0};
+    if (!job->waitable && (job->cancel == NULL) && (job->tag == 0)) {
+        return 0;
+    }
+
+    struct thread_pool_cancel *cancel = job->cancel;
+    if (cancel != NULL) {
+        cancel_ref(cancel);
+    } else if (job->tag != 0) {
+        cancel = cancel_tag_get(self, job->tag);
+        if (cancel == NULL) {
+            return -1;
         }
     }
-    if (queue_dequeue(self->global_jobs, job) == 0) {
-        return 0;
+    struct job_record *rec = mempool_alloc(&self->records);
+    if (rec == NULL) {
+        cancel_unref(cancel);
+        return -1;
     }
+    promise_init(&rec->prms);
+    rec->ftr = promise_get_future(&rec->prms);
+    rec->pool = &self->records;
+    rec->start_time = 0;
+    rec->end_time = 0;
+    rec->group = NULL;
+    rec->cancel = cancel;
+    atomic_store(&rec->state, job->waitable ? PENDING : DETACHED);
+    job->handle = (jhandle_t){
+        .rec = rec,
+        .gen = atomic_load(&rec->gen),
+    };
 
-    return -1;
+    return 0;
 }
 
-STATIC int worker(void *arg)
+STATIC void job_record_free(struct job_record *rec)
 {
-    SELFLIZE(struct worker *, arg);
-
-    ctx = self;
-    atomic_store(&self->status, IDLE);
-
-    char name[32];
-    snprintf(name, sizeof(name), "worker[%d]", self->wid);
-    thrd_set_name(thrd_current(), name);
+    cancel_unref(rec->cancel);
+    rec->cancel = NULL;
+    atomic_fetch_add(&rec->gen, 1);
+    mempool_free(rec->pool, rec);
+}
 
-    while (pthread_testcancel(), true) {
-        job_t job;
+/**
+ *  Publish the outcome of a waitable job.
+ */
+STATIC void job_record_complete(struct job_record *rec, int value, int64_t start_time,
+                                int64_t end_time)
+{
+    rec->start_time = start_time;
+    rec->end_time = end_time;
 
-        lock (self->mtx) {
-            while (job_seeking(self, &job) != 0) {
-                pthread_cond_wait(self->cnd, self->mtx);
-            }
-        }
+    int state = PENDING;
+    if (!atomic_compare_exchange_strong(&rec->state, &state, DONE)) {
+        /* Released without waiting, nobody will read it. */
+        job_record_free(rec);
+        return;
+    }
+    promise_set_value(&rec->prms, value);
+}
 
-        atomic_store(&self->job, job);
-        if (job.name[0] != '\0') {
-            thrd_set_name(self->thr, job.name);
-        }
-        atomic_fetch_add(self->num_active, 1);
-        job.func(job.arg);
-        atomic_fetch_sub(self->num_active, 1);
-        if (job.name[0] != '\0') {
-            thrd_set_name(self->thr, name);
-        }
+int thrdpool_job_init(job_t *job, int (*func)(void *), void *arg)
+{
+    if ((job == NULL) || (func == NULL)) {
+        errno = EINVAL;
+        return -1;
     }
 
+    *job = JOB_MAKER(func, arg);
+
     return 0;
 }
 
-STATIC int worker_creator(void *arg)
+/**
+ *  Name string of an interned ID, "" for zero.
+ */
+static inline const char *job_name_lookup(uint16_t id)
 {
-    SELFLIZE(struct thread_pool *, arg);
+    if (id == 0) {
+        return "";
+    }
 
-    for (size_t i = 1; i < self->num_workers; ++i) {
-        struct worker *w = &self->workers[i];
-        pthread_testcancel();
+    char (*chunk)[JOB_NAME_MAX] = atomic_load_explicit(&names.chunks[id >> NAME_CHUNK_BITS],
+                                                       memory_order_acquire);
+    return chunk[id & (NAME_CHUNK_SIZE - 1)];
+}
 
-        if (thrd_create(&w->thr, worker, w) != 0) {
-            atomic_store(&w->status, FAIL);
+/**
+ *  Find the slot of @c name, or the free slot where it belongs.
+ */
+STATIC _Atomic(uint16_t) *job_name_probe(const char *name, uint32_t hash, uint16_t *id)
+{
+    for (size_t i = 0; i < NAME_SLOTS; ++i) {
+        _Atomic(uint16_t) *slot = &names.slots[(hash + i) & (NAME_SLOTS - 1)];
+        *id = atomic_load_explicit(slot, memory_order_acquire);
+        if ((*id == 0) || (strcmp(job_name_lookup(*id), name) == 0)) {
+            return slot;
         }
     }
-    promise_set_value(&self->prms, 0);
 
-    return worker(&self->workers[0]);
+    /* Unreachable, the table is never more than half full. */
+    return NULL;
 }
 
-tpool_t thrdpool_create(size_t num_workers)
+/**
+ *  Intern @c name, truncated to JOB_NAME_MAX - 1 characters.
+ *
+ *  Known names are found without locking, new ones are added under
+ *  the table lock. Once the table is full, or a chunk cannot be
+ *  allocated, new names are left unnamed (ID zero).
+ */
+STATIC void job_name_intern(const char *name, uint16_t *id)
 {
-    if (num_workers == 0) {
-        errno = EINVAL;
-        return NULL;
+    char key[JOB_NAME_MAX] = {0};
+    strncpy(key, name, sizeof(key) - 1);
+    if (key[0] == '\0') {
+        *id = 0;
+        return;
     }
 
-    size_t workers_size = sizeof(struct worker) * (num_workers + 1);
-    struct thread_pool *self = malloc(sizeof(*self) + workers_size);
-    if (self == NULL) {
-        return NULL;
+    uint32_t hash = UINT32_C(2166136261);
+    for (size_t i = 0; key[i] != '\0'; ++i) {
+        hash = (hash ^ (uint8_t)key[i]) * UINT32_C(16777619);
+    }
+    if (*job_name_probe(key, hash, id) != 0) {
+        return;
     }
 
-    *self = THREAD_POOL_MAKER(num_workers);
-    if (queue_create(&self->jobs, sizeof(job_t), MAX_JOBS) != 0) {
-        free(self);
-        return NULL;
+    pthread_mutex_lock(&names.lock);
+    _Atomic(uint16_t) *slot = job_name_probe(key, hash, id);
+    if ((*id != 0) || (names.num_names + 1 >= NAMES_MAX)) {
+        pthread_mutex_unlock(&names.lock);
+        return;
     }
-    self->ftr = promise_get_future(&self->prms);
-    for (size_t i = 0; i < num_workers; ++i) {
-        struct worker *w = &self->workers[i];
-        *w = WORKER_MAKER(i + 1, self);
-        if (queue_create(&w->local_jobs, sizeof(job_t), MAX_JOBS) != 0) {
-            queue_destroy(&self->jobs);
-            free(self);
-            return NULL;
+
+    size_t next = names.num_names + 1;
+    char (*chunk)[JOB_NAME_MAX] = atomic_load_explicit(&names.chunks[next >> NAME_CHUNK_BITS],
+                                                       memory_order_relaxed);
+    if (chunk == NULL) {
+        chunk = calloc(NAME_CHUNK_SIZE, JOB_NAME_MAX);
+        if (chunk == NULL) {
+            pthread_mutex_unlock(&names.lock);
+            return;
         }
+        atomic_store_explicit(&names.chunks[next >> NAME_CHUNK_BITS], chunk, memory_order_release);
     }
-    self->workers[num_workers] = WORKER_MAKER(-1, self);
+    memcpy(chunk[next & (NAME_CHUNK_SIZE - 1)], key, sizeof(key));
+    names.num_names = next;
+    *id = (uint16_t)next;
+    atomic_store_explicit(slot, *id, memory_order_release);
+    pthread_mutex_unlock(&names.lock);
+}
 
-    int ret = thrd_create(&self->workers[0].thr, worker_creator, self);
-    if (ret != 0) {
-        thrdpool_destroy(self);
-        return NULL;
+int thrdpool_job_set_name(job_t *job, const char *name)
+{
+    if ((job == NULL) || (job->func == NULL) || (name == NULL)) {
+        errno = EINVAL;
+        return -1;
     }
 
-    return self;
+    job_name_intern(name, &job->name);
+
+    return 0;
 }
 
-void thrdpool_destroy(tpool_t tp)
+const char *thrdpool_current_job_name(void)
 {
-    if (tp == NULL) {
-        return;
+    return thrdpool_job_label;
+}
+
+const char *thrdpool_job_get_name(const job_t *job)
+{
+    if (job == NULL) {
+        errno = EINVAL;
+        return NULL;
     }
 
-    SELFLIZE(struct thread_pool *, tp);
+    return job_name_lookup(job->name);
+}
 
-    future_get_value(self->ftr, NULL);
-    for (int i = (int)self->num_workers - 1; i >= 0; --i) {
-        struct worker *w = &self->workers[i];
-        if (thrd_cancel(w->thr) == 0) {
-            thrd_join(w->thr, NULL);
-        }
-    }
-    for (int i = (int)self->num_workers - 1; i >= 0; --i) {
-        struct worker *w = &self->workers[i];
-        queue_destroy(&w->local_jobs);
+int thrdpool_job_set_waitable(job_t *job, bool waitable)
+{
+    if ((job == NULL) || (job->func == NULL)) {
+        errno = EINVAL;
+        return -1;
     }
-    queue_destroy(&self->jobs);
-    free(self);
+
+    job->waitable = waitable;
+
+    return 0;
 }
 
-ssize_t thrdpool_num_workers(tpool_t tp)
+int thrdpool_job_set_priority(job_t *job, enum thrdpool_priority priority)
 {
-    if (tp == NULL) {
+    if ((job == NULL) || (job->func == NULL) || ((unsigned int)priority >= THRDPOOL_PRIORITIES)) {
         errno = EINVAL;
         return -1;
     }
 
-    SELFLIZE(struct thread_pool *, tp);
+    job->priority = (uint8_t)priority;
 
-    return self->num_workers;
+    return 0;
 }
 
-int thrdpool_add(tpool_t tp, job_t *job)
+int thrdpool_job_set_deadline(job_t *job, int64_t deadline)
 {
-    if ((tp == NULL) || (job == NULL)) {
+    if ((job == NULL) || (job->func == NULL) || (deadline < 0)) {
         errno = EINVAL;
         return -1;
     }
 
-    SELFLIZE(struct thread_pool *, tp);
+    job->deadline = deadline;
 
-    static _Atomic(juid_t) juid = ATOMIC_VAR_INIT(0);
+    return 0;
+}
 
-    job->id = atomic_fetch_add(&juid, 1);
+int thrdpool_job_set_cancel(job_t *job, tcancel_t cancel)
+{
+    if ((job == NULL) || (job->func == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
 
-    int ret;
-    lock (&self->seek_mtx) {
-        if (ctx != NULL) {
-            ret = queue_enqueue(&ctx->local_jobs, job);
-            if (ret == 0) {
-                atomic_fetch_add(&self->num_local_jobs, 1);
-            }
-        } else {
-            ret = queue_enqueue(&self->jobs, job);
-        }
-        pthread_cond_broadcast(&self->seek_cnd);
+    job->cancel = cancel;
+
+    return 0;
+}
+
+int thrdpool_job_set_tag(job_t *job, uint32_t tag)
+{
+    if ((job == NULL) || (job->func == NULL)) {
+        errno = EINVAL;
+        return -1;
     }
 
-    return (ret == 0) ? 0 : -1;
+    job->tag = tag;
+
+    return 0;
+}
+
+tcancel_t thrdpool_cancel_create(void)
+{
+    return cancel_alloc();
+}
+
+void thrdpool_cancel_destroy(tcancel_t cancel)
+{
+    cancel_unref(cancel);
+}
+
+int thrdpool_cancel_request(tcancel_t cancel)
+{
+    if (cancel == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    atomic_store_explicit(&cancel->requested, true, memory_order_release);
+
+    return 0;
+}
+
+bool thrdpool_cancel_requested(tcancel_t cancel)
+{
+    return (cancel != NULL) && atomic_load_explicit(&cancel->requested, memory_order_acquire);
+}
+
+bool thrdpool_cancelled(void)
+{
+    return (ctx != NULL) && thrdpool_cancel_requested(ctx->cancel);
+}
+
+int thrdpool_job_set_tenant(job_t *job, ttenant_t tenant)
+{
+    if ((job == NULL) || (job->func == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    job->tenant = tenant;
+
+    return 0;
+}
+
+int thrdpool_job_set_inline_arg(job_t *job, const void *data, size_t size)
+{
+    if ((job == NULL) || (job->func == NULL) || ((data == NULL) && (size > 0))
+        || (size > sizeof(job->data))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (size > 0) {
+        memcpy(job->data, data, size);
+    }
+    job->inline_size = (uint8_t)size;
+    job->inlined = true;
+
+    return 0;
+}
+
+int thrdpool_job_set_destructor(job_t *job, void (*dtor)(void *))
+{
+    if ((job == NULL) || (job->func == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    job->dtor = dtor;
+
+    return 0;
+}
+
+/**
+ *  Argument to run @c job on, its inline copy lives in the job itself.
+ */
+static inline void *job_arg(job_t *job)
+{
+    return job->inlined ? (void *)job->data : job->arg;
+}
+
+/**
+ *  Release the argument of a job that has run or will never run.
+ */
+static inline void job_release_arg(job_t *job)
+{
+    if (job->dtor != NULL) {
+        job->dtor(job_arg(job));
+    }
+}
+
+/**
+ *  Pack what a worker needs of @c job into a queue entry.
+ *
+ *  An inline argument too large for the entry is copied to a pooled box.
+ *  The record, if any, must be attached already.
+ */
+static inline int job_entry_make(struct thread_pool *self, struct job_entry *entry,
+                                 const job_t *job, int64_t submit_time)
+{
+    entry->func = job->func;
+    if (!job->inlined) {
+        entry->arg = job->arg;
+        entry->carry = CARRY_POINTER;
+    } else if (job->inline_size <= sizeof(entry->data)) {
+        memcpy(entry->data, job->data, sizeof(entry->data));
+        entry->carry = CARRY_INLINE;
+    } else {
+        entry->arg = mempool_alloc(&self->payloads);
+        if (entry->arg == NULL) {
+            return -1;
+        }
+        memcpy(entry->arg, job->data, job->inline_size);
+        entry->carry = CARRY_BOXED;
+    }
+    entry->dtor = job->dtor;
+    entry->submit_time = submit_time;
+    entry->id = job->id;
+    entry->name = job->name;
+    entry->waitable = (job->handle.rec != NULL);
+    if (entry->waitable) {
+        job->handle.rec->group = job->group;
+        entry->done = job->handle.rec;
+    } else {
+        entry->done = job->group;
+    }
+
+    return 0;
+}
+
+static inline void *job_entry_arg(struct job_entry *entry)
+{
+    return (entry->carry == CARRY_INLINE) ? (void *)entry->data : entry->arg;
+}
+
+/**
+ *  Free the boxed argument of an entry that has run or will never run.
+ */
+static inline void job_entry_release(struct thread_pool *self, struct job_entry *entry)
+{
+    if (entry->carry == CARRY_BOXED) {
+        mempool_free(&self->payloads, entry->arg);
+    }
+}
+
+static inline struct thread_pool_group *job_entry_group(const struct job_entry *entry)
+{
+    return entry->waitable ? ((struct job_record *)entry->done)->group : entry->done;
+}
+
+/**
+ *  Token of the job, its own or else its group's, NULL if none.
+ */
+static inline struct thread_pool_cancel *job_entry_cancel(const struct job_entry *entry)
+{
+    struct thread_pool_group *grp = job_entry_group(entry);
+    if (entry->waitable && (((struct job_record *)entry->done)->cancel != NULL)) {
+        return ((struct job_record *)entry->done)->cancel;
+    }
+    return (grp != NULL) ? grp->cancel : NULL;
+}
+
+static inline uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/**
+ *  Steal half of a victim's jobs, run the first and keep the rest local.
+ *
+ *  The last victim that had work is tried first, then every colleague
+ *  from a random start, so thieves do not all line up on the same one.
+ *  Must be called by @c self with its local deque empty.
+ */
+STATIC int work_steal(struct worker *self, int level, struct job_entry *job)
+{
+    struct job_entry loot[STEAL_BATCH];
+    size_t num_workers = self->pool->num_workers;
+    size_t start = xorshift32(&self->rng) % num_workers;
+
+    for (size_t k = 0; k <= num_workers; ++k) {
+        size_t i;
+        if (k == 0) {
+            if (self->last_victim < 0) {
+                continue;
+            }
+            i = (size_t)self->last_victim;
+        } else {
+            i = (start + k - 1) % num_workers;
+        }
+        struct worker *victim = &self->colleagues[i];
+        if ((victim == self) || (deque_size(&victim->local_jobs[level]) <= 0)) {
+            continue;
+        }
+        ssize_t num = deque_shift_batch(&victim->local_jobs[level], loot, self->pool->steal_max);
+        if (num <= 0) {
+            relaxed_add(&self->counters.steal_failures, 1);
+            continue;
+        }
+
+        *job = loot[0];
+        if (num > 1) {
+            /* Cannot fail, the deque is empty and holds steal_max jobs. */
+            deque_push_batch(&self->local_jobs[level], &loot[1], (size_t)num - 1);
+        }
+        relaxed_add(&self->counters.stolen, (uint64_t)num);
+        relaxed_add(&self->counters.stolen_from[i], (uint64_t)num);
+        self->last_victim = (int)i;
+        return 0;
+    }
+
+    self->last_victim = -1;
+    errno = ENOENT;
+    return -1;
+}
+
+STATIC void job_discard(struct thread_pool *self, struct job_entry *job, int error);
+
+STATIC int edf_shard_init(struct edf_shard *shard, size_t capacity, bool growable,
+                          _Atomic(uint64_t) *busy, uint64_t bit)
+{
+    shard->items = malloc(sizeof(*shard->items) * capacity);
+    if (shard->items == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->num = 0;
+    shard->capacity = capacity;
+    shard->growable = growable;
+    atomic_init(&shard->head, EDF_EMPTY);
+    atomic_init(&shard->depth, 0);
+    shard->busy = busy;
+    shard->bit = bit;
+
+    return 0;
+}
+
+STATIC void edf_shard_destroy(struct edf_shard *shard)
+{
+    if (shard->items != NULL) {
+        pthread_mutex_destroy(&shard->lock);
+        free(shard->items);
+        shard->items = NULL;
+    }
+}
+
+static inline bool edf_before(const struct edf_item *a, const struct edf_item *b)
+{
+    if (a->deadline != b->deadline) {
+        return a->deadline < b->deadline;
+    }
+    return (int32_t)(a->entry.id - b->entry.id) < 0;
+}
+
+/**
+ *  Must be called with the shard locked and room for one more item.
+ */
+STATIC void edf_insert(struct edf_shard *shard, const struct edf_item *item)
+{
+    size_t i = shard->num++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!edf_before(item, &shard->items[parent])) {
+            break;
+        }
+        shard->items[i] = shard->items[parent];
+        i = parent;
+    }
+    shard->items[i] = *item;
+}
+
+/**
+ *  Must be called with the shard locked and not empty.
+ */
+STATIC void edf_remove_min(struct edf_shard *shard, struct edf_item *item)
+{
+    struct edf_item *items = shard->items;
+
+    *item = items[0];
+    struct edf_item last = items[--shard->num];
+    size_t i = 0;
+    while (true) {
+        size_t child = (2 * i) + 1;
+        if (child >= shard->num) {
+            break;
+        }
+        if ((child + 1 < shard->num) && edf_before(&items[child + 1], &items[child])) {
+            ++child;
+        }
+        if (!edf_before(&items[child], &last)) {
+            break;
+        }
+        items[i] = items[child];
+        i = child;
+    }
+    items[i] = last;
+}
+
+/**
+ *  Must be called with the shard locked, which also guards its busy bit.
+ */
+static inline void edf_publish(struct edf_shard *shard)
+{
+    atomic_store_explicit(&shard->depth, shard->num, memory_order_relaxed);
+    atomic_store(&shard->head, (shard->num > 0) ? shard->items[0].deadline : EDF_EMPTY);
+
+    bool busy = (shard->num > 0);
+    if (busy != ((atomic_load_explicit(shard->busy, memory_order_relaxed) & shard->bit) != 0)) {
+        if (busy) {
+            atomic_fetch_or(shard->busy, shard->bit);
+        } else {
+            atomic_fetch_and(shard->busy, ~shard->bit);
+        }
+    }
+}
+
+/**
+ *  Queue @c num jobs into one shard, all or none. Workers add to their
+ *  own shard, other threads spread over the shards of the workers that
+ *  are always alive, in turn.
+ */
+STATIC int edf_push(struct thread_pool *self, const struct job_entry *entries,
+                    const int64_t *deadlines, size_t num)
+{
+    struct edf_shard *shard;
+    if ((ctx != NULL) && (ctx->pool == self)) {
+        shard = &ctx->edf;
+    } else {
+        size_t next = atomic_fetch_add_explicit(&self->edf_next, 1, memory_order_relaxed);
+        shard = &self->workers[next % self->min_workers].edf;
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    if (shard->num + num > shard->capacity) {
+        if (!shard->growable) {
+            pthread_mutex_unlock(&shard->lock);
+            errno = ENOMEM;
+            return -1;
+        }
+        size_t capacity = shard->capacity;
+        while (capacity < shard->num + num) {
+            capacity *= 2;
+        }
+        struct edf_item *items = realloc(shard->items, sizeof(*items) * capacity);
+        if (items == NULL) {
+            pthread_mutex_unlock(&shard->lock);
+            return -1;
+        }
+        shard->items = items;
+        shard->capacity = capacity;
+    }
+    for (size_t i = 0; i < num; ++i) {
+        struct edf_item item = {
+            .deadline = deadlines[i],
+            .entry = entries[i],
+        };
+        edf_insert(shard, &item);
+    }
+    edf_publish(shard);
+    pthread_mutex_unlock(&shard->lock);
+
+    return 0;
+}
+
+/**
+ *  Take the earliest deadline of the busy shards, our own on a tie, and
+ *  drop expired jobs on the way if asked to.
+ */
+STATIC int edf_seeking(struct worker *self, struct job_entry *job)
+{
+    struct thread_pool *pool = self->pool;
+    size_t words = (pool->num_workers + IDLE_MASK_BITS - 1) / IDLE_MASK_BITS;
+
+    while (true) {
+        size_t index = self->wid - 1;
+        int64_t earliest = atomic_load(&self->edf.head);
+        for (size_t w = 0; w < words; ++w) {
+            uint64_t mask = atomic_load(&pool->edf_busy[w]);
+            while (mask != 0) {
+                size_t i = (w * IDLE_MASK_BITS) + __builtin_ctzll(mask);
+                mask &= mask - 1;
+                int64_t head = atomic_load(&pool->workers[i].edf.head);
+                if (head < earliest) {
+                    earliest = head;
+                    index = i;
+                }
+            }
+        }
+        if (earliest == EDF_EMPTY) {
+            errno = ENOENT;
+            return -1;
+        }
+
+        struct worker *victim = &pool->workers[index];
+        struct edf_item item;
+        pthread_mutex_lock(&victim->edf.lock);
+        if (victim->edf.num == 0) {
+            pthread_mutex_unlock(&victim->edf.lock);
+            if (victim != self) {
+                relaxed_add(&self->counters.steal_failures, 1);
+            }
+            continue;
+        }
+        edf_remove_min(&victim->edf, &item);
+        edf_publish(&victim->edf);
+        pthread_mutex_unlock(&victim->edf.lock);
+        if (victim != self) {
+            relaxed_add(&self->counters.stolen, 1);
+            relaxed_add(&self->counters.stolen_from[index], 1);
+        }
+
+        if (pool->drop_expired && (item.deadline != EDF_NONE) && (item.deadline < now_ns())) {
+            relaxed_add(&self->counters.expired, 1);
+            job_discard(pool, &item.entry, -ETIMEDOUT);
+            continue;
+        }
+        *job = item.entry;
+        self->picked = item.deadline;
+        return 0;
+    }
+}
+
+/**
+ *  Deadline @c job is queued with, jobs added by a running job inherit its.
+ */
+static inline int64_t job_deadline(struct thread_pool *self, const job_t *job)
+{
+    if (job->deadline != 0) {
+        return job->deadline;
+    }
+    return ((ctx != NULL) && (ctx->pool == self)) ? ctx->deadline : EDF_NONE;
+}
+
+static inline void tenant_init(struct thread_pool_tenant *self, struct thread_pool *pool,
+                               que_t *jobs, uint32_t weight)
+{
+    self->pool = pool;
+    self->jobs = jobs;
+    atomic_init(&self->weight, weight);
+    atomic_init(&self->depth, 0);
+    self->index = 0;
+    self->bit = 0;
+    atomic_init(&self->served, 0);
+    atomic_init(&self->served_time, 0);
+}
+
+/**
+ *  Count jobs on a tenant of its own, setting its busy bit when it has some.
+ */
+static inline void tenant_depth_add(struct thread_pool_tenant *self, size_t num)
+{
+    if (atomic_fetch_add(&self->depth, num) == 0) {
+        atomic_fetch_or(&self->pool->tenants_busy, self->bit);
+    }
+}
+
+static inline void tenant_depth_sub(struct thread_pool_tenant *self, size_t num)
+{
+    if (atomic_fetch_sub(&self->depth, num) == num) {
+        atomic_fetch_and(&self->pool->tenants_busy, ~self->bit);
+        /* An enqueuer counted in between may have set the bit before we cleared it. */
+        if (atomic_load(&self->depth) != 0) {
+            atomic_fetch_or(&self->pool->tenants_busy, self->bit);
+        }
+    }
+}
+
+STATIC int tenant_enqueue(struct thread_pool_tenant *self, const struct job_entry *jobs, size_t num)
+{
+    /* Counted first, so a worker dequeuing at once never takes it below zero. */
+    tenant_depth_add(self, num);
+    int ret = (num == 1) ? queue_enqueue(self->jobs, jobs)
+                         : queue_enqueue_batch(self->jobs, jobs, num);
+    if (ret != 0) {
+        tenant_depth_sub(self, num);
+    }
+
+    return ret;
+}
+
+static inline int tenant_dequeue(struct thread_pool_tenant *self, struct job_entry *job)
+{
+    bool own = (self != &self->pool->default_tenant);
+    if (own && (atomic_load_explicit(&self->depth, memory_order_relaxed) == 0)) {
+        return -1;
+    }
+    if (queue_dequeue(self->jobs, job) != 0) {
+        return -1;
+    }
+    if (own) {
+        tenant_depth_sub(self, 1);
+    }
+
+    return 0;
+}
+
+static inline bool tenant_empty(struct thread_pool_tenant *self)
+{
+    if (self == &self->pool->default_tenant) {
+        return queue_size(self->jobs) == 0;
+    }
+    return atomic_load_explicit(&self->depth, memory_order_relaxed) == 0;
+}
+
+static inline int64_t tenant_quantum(struct thread_pool_tenant *self)
+{
+    return (int64_t)atomic_load_explicit(&self->weight, memory_order_relaxed) * TENANT_QUANTUM_NS;
+}
+
+/**
+ *  Tenant after @c index in the round that has jobs, @c index itself if
+ *  no other one has. Tenant @c i above zero has bit @c i - 1 in @c busy.
+ */
+static inline size_t tenant_next(struct thread_pool *pool, uint64_t busy, size_t index)
+{
+    uint64_t after = (index < THRDPOOL_MAX_TENANTS) ? (busy & (~UINT64_C(0) << index)) : 0;
+    if (after != 0) {
+        return (size_t)__builtin_ctzll(after) + 1;
+    }
+    if ((index != 0) && !tenant_empty(&pool->default_tenant)) {
+        return 0;
+    }
+    if (busy != 0) {
+        return (size_t)__builtin_ctzll(busy) + 1;
+    }
+
+    return index;
+}
+
+/**
+ *  Grant every tenant with jobs the rounds until the first one in debt
+ *  pays off, false if none has jobs.
+ */
+STATIC bool tenant_catch_up(struct worker *self, uint64_t busy)
+{
+    struct thread_pool *pool = self->pool;
+    size_t waiting[THRDPOOL_MAX_TENANTS + 1];
+    size_t num = 0;
+    if (!tenant_empty(&pool->default_tenant)) {
+        waiting[num++] = 0;
+    }
+    for (; busy != 0; busy &= busy - 1) {
+        size_t index = (size_t)__builtin_ctzll(busy) + 1;
+        if (!tenant_empty(pool->tenants[index])) {
+            waiting[num++] = index;
+        }
+    }
+    if (num == 0) {
+        return false;
+    }
+
+    int64_t rounds = INT64_MAX;
+    for (size_t i = 0; i < num; ++i) {
+        int64_t need = -self->deficits[waiting[i]] / tenant_quantum(pool->tenants[waiting[i]]) + 1;
+        rounds = (need < rounds) ? need : rounds;
+    }
+    for (size_t i = 0; i < num; ++i) {
+        self->deficits[waiting[i]] += rounds * tenant_quantum(pool->tenants[waiting[i]]);
+    }
+
+    return true;
+}
+
+/**
+ *  Deficit round-robin over the tenants with jobs.
+ *
+ *  Every worker runs its own rounds, with its own cursor and deficits,
+ *  so seeking takes no lock and the shares hold across the workers in
+ *  sum. The tenant under the cursor is granted its quantum on arrival
+ *  and served until that is spent. The cursor skips tenants without
+ *  jobs by their busy bits. Jobs are charged their run time once they
+ *  ran, so a tenant of long jobs falls into debt and sits out rounds
+ *  instead of getting more than its share. When every tenant with jobs
+ *  is in debt, the rounds until the first one pays off are granted at
+ *  once rather than walked one by one.
+ */
+STATIC int tenant_seeking(struct worker *self, struct job_entry *job)
+{
+    struct thread_pool *pool = self->pool;
+    struct thread_pool_tenant *found = NULL;
+
+    uint64_t busy = atomic_load(&pool->tenants_busy);
+    size_t num = (size_t)__builtin_popcountll(busy) + 1;
+    for (int pass = 0; (found == NULL) && (pass < 2); ++pass) {
+        for (size_t i = 0; i < num; ++i) {
+            struct thread_pool_tenant *t = pool->tenants[self->drr_next];
+            if (self->deficits[self->drr_next] > 0) {
+                if (tenant_dequeue(t, job) == 0) {
+                    found = t;
+                    break;
+                }
+                /* Ran dry, what is left is not carried over. */
+                self->deficits[self->drr_next] = 0;
+            }
+            self->drr_next = tenant_next(pool, busy, self->drr_next);
+            self->deficits[self->drr_next] += tenant_quantum(pool->tenants[self->drr_next]);
+        }
+        if ((found != NULL) || (pass > 0) || !tenant_catch_up(self, busy)) {
+            break;
+        }
+    }
+
+    self->picked_tenant = found;
+    return (found != NULL) ? 0 : -1;
+}
+
+/**
+ *  Charge the run time of a job to its tenant, in the worker's round.
+ */
+static inline void tenant_charge(struct worker *self, struct thread_pool_tenant *tenant,
+                                 int64_t elapsed)
+{
+    self->deficits[tenant->index] -= elapsed;
+    /* Shared by every worker, unlike their own counters. */
+    atomic_fetch_add_explicit(&tenant->served, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&tenant->served_time, (uint64_t)elapsed, memory_order_relaxed);
+}
+
+STATIC int job_seeking_level(struct worker *self, int level, struct job_entry *job)
+{
+    if (deque_pop(&self->local_jobs[level], job) == 0) {
+        return 0;
+    }
+    if (work_steal(self, level, job) == 0) {
+        return 0;
+    }
+    /* Until another tenant has jobs, the default one is served without rounds. */
+    if ((level == THRDPOOL_PRIO_NORMAL) && (atomic_load(&self->pool->tenants_busy) != 0)) {
+        return tenant_seeking(self, job);
+    }
+    if (queue_dequeue(&self->global_jobs[level], job) == 0) {
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+ *  Count a job picked at @c level against every lower level.
+ */
+static inline void job_aging(struct worker *self, int level)
+{
+    self->passed[level] = 0;
+    for (int i = level + 1; i < THRDPOOL_PRIORITIES; ++i) {
+        if (self->passed[i] < PRIORITY_AGING) {
+            ++self->passed[i];
+        }
+    }
+}
+
+/**
+ *  Search level by level from the highest, except that the lowest level
+ *  passed over PRIORITY_AGING times is searched first once.
+ */
+STATIC int job_seeking(struct worker *self, struct job_entry *job)
+{
+    if (self->pool->edf) {
+        return edf_seeking(self, job);
+    }
+
+    unsigned int levels = atomic_load(&self->pool->levels);
+
+    for (int level = THRDPOOL_PRIORITIES - 1; level > 0; --level) {
+        if (self->passed[level] >= PRIORITY_AGING) {
+            self->passed[level] = 0;
+            if (((levels & (1u << level)) != 0) && (job_seeking_level(self, level, job) == 0)) {
+                job_aging(self, level);
+                return 0;
+            }
+            break;
+        }
+    }
+    for (int level = 0; level < THRDPOOL_PRIORITIES; ++level) {
+        if (((levels & (1u << level)) != 0) && (job_seeking_level(self, level, job) == 0)) {
+            job_aging(self, level);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ *  Let workers search @c level from now on.
+ */
+static inline void pool_use_level(struct thread_pool *self, int level)
+{
+    if ((atomic_load_explicit(&self->levels, memory_order_relaxed) & (1u << level)) == 0) {
+        atomic_fetch_or(&self->levels, 1u << level);
+    }
+}
+
+static inline size_t pool_global_depth(struct thread_pool *self)
+{
+    if (self->edf) {
+        return 0;
+    }
+
+    size_t depth = 0;
+    for (int level = 0; level < THRDPOOL_PRIORITIES; ++level) {
+        depth += (size_t)queue_size(&self->jobs[level]);
+    }
+    size_t num = atomic_load(&self->num_tenants);
+    for (size_t i = 1; i < num; ++i) {
+        depth += atomic_load_explicit(&self->tenants[i]->depth, memory_order_relaxed);
+    }
+    return depth;
+}
+
+static inline size_t worker_local_depth(struct worker *self)
+{
+    if (self->pool->edf) {
+        return atomic_load_explicit(&self->edf.depth, memory_order_relaxed);
+    }
+
+    size_t depth = 0;
+    for (int level = 0; level < THRDPOOL_PRIORITIES; ++level) {
+        depth += (size_t)deque_size(&self->local_jobs[level]);
+    }
+    return depth;
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+static inline void futex_wait(_Atomic(uint32_t) *addr, uint32_t val, const struct timespec *timeout)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+static inline void futex_wake(_Atomic(uint32_t) *addr, int num)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, num, NULL, NULL, 0);
+}
+
+/**
+ *  Unpark one parked worker, if any.
+ *
+ *  The caller must have counted the woken worker in num_spinning.
+ */
+STATIC bool worker_unpark(struct thread_pool *self)
+{
+    for (size_t i = 0; i < IDLE_MASK_WORDS; ++i) {
+        uint64_t mask = atomic_load(&self->idle_mask[i]);
+        while (mask != 0) {
+            uint64_t bit = mask & -mask;
+            mask = atomic_fetch_and(&self->idle_mask[i], ~bit);
+            if ((mask & bit) != 0) {
+                struct worker *w = &self->workers[(i * IDLE_MASK_BITS) + __builtin_ctzll(bit)];
+                atomic_store(&w->wakeup, 1);
+                futex_wake(&w->wakeup, 1);
+                return true;
+            }
+            mask &= ~bit;
+        }
+    }
+
+    return false;
+}
+
+/**
+ *  Unpark exactly one idle worker, unless some worker is already spinning.
+ *
+ *  The waker hands its spinning slot to the worker it wakes,
+ *  so that concurrent submitters do not wake a herd.
+ */
+STATIC bool worker_wakeup(struct thread_pool *self)
+{
+    size_t none = 0;
+    if (!atomic_compare_exchange_strong(&self->num_spinning, &none, 1)) {
+        return false;
+    }
+    if (!worker_unpark(self)) {
+        atomic_fetch_sub(&self->num_spinning, 1);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ *  Unpark up to @c num idle workers at once.
+ */
+STATIC size_t worker_wakeup_many(struct thread_pool *self, size_t num)
+{
+    if (num == 1) {
+        return worker_wakeup(self) ? 1 : 0;
+    }
+
+    size_t woken = 0;
+    while (woken < num) {
+        atomic_fetch_add(&self->num_spinning, 1);
+        if (!worker_unpark(self)) {
+            atomic_fetch_sub(&self->num_spinning, 1);
+            break;
+        }
+        ++woken;
+    }
+
+    return woken;
+}
+
+/**
+ *  Give an elastic worker's slot back after its idle timeout.
+ *
+ *  Called parked and announced idle. Fails if a waker or
+ *  thrdpool_destroy() got to the worker first.
+ */
+STATIC bool worker_retire(struct worker *self, _Atomic(uint64_t) *word, uint64_t bit)
+{
+    struct thread_pool *pool = self->pool;
+
+    if ((atomic_fetch_and(word, ~bit) & bit) == 0) {
+        /* A waker has taken the bit and counts us as spinning. */
+        return false;
+    }
+    enum worker_state state = IDLE;
+    if (!atomic_compare_exchange_strong(&self->status, &state, RETIRING)) {
+        return false;
+    }
+
+    atomic_fetch_sub(self->num_idle, 1);
+    atomic_fetch_sub(&pool->num_alive, 1);
+    thrd_detach(thrd_current());
+    /* The slot may be respawned from here on, do not touch it. */
+    atomic_store(&self->status, INIT);
+
+    return true;
+}
+
+/**
+ *  Park the worker until a job can be sought.
+ *
+ *  Called with the worker counted in num_spinning, returns with a job
+ *  and the worker still counted. Returns false instead if an elastic
+ *  worker has retired or the pool is stopping.
+ */
+STATIC bool worker_park(struct worker *self, struct job_entry *job)
+{
+    struct thread_pool *pool = self->pool;
+    size_t index = self->wid - 1;
+    bool elastic = (index >= pool->min_workers);
+    _Atomic(uint64_t) *word = &pool->idle_mask[index / IDLE_MASK_BITS];
+    uint64_t bit = UINT64_C(1) << (index % IDLE_MASK_BITS);
+
+    while (true) {
+        atomic_store(&self->wakeup, 0);
+        atomic_fetch_or(word, bit);
+        atomic_fetch_add(self->num_idle, 1);
+        atomic_fetch_sub(&pool->num_spinning, 1);
+
+        /* Re-check after announcing, pairs with thrdpool_add. */
+        if (job_seeking(self, job) == 0) {
+            atomic_fetch_sub(self->num_idle, 1);
+            if ((atomic_fetch_and(word, ~bit) & bit) != 0) {
+                atomic_fetch_add(&pool->num_spinning, 1);
+            }
+            /* Otherwise a waker has taken the bit and counts us as spinning. */
+            return true;
+        }
+
+        if (atomic_load(&pool->stopping)) {
+            /* Announced after thrdpool_shutdown() woke everyone, leave now. */
+            atomic_fetch_sub(self->num_idle, 1);
+            if ((atomic_fetch_and(word, ~bit) & bit) == 0) {
+                /* A waker has taken the bit and counts us as spinning. */
+                atomic_fetch_sub(&pool->num_spinning, 1);
+            }
+            return false;
+        }
+
+        relaxed_add(&self->counters.parks, 1);
+        int64_t parked = now_ns();
+        bool retirable = elastic;
+        while (atomic_load(&self->wakeup) == 0) {
+            if (!retirable) {
+                futex_wait(&self->wakeup, 0, NULL);
+                continue;
+            }
+
+            int64_t left = pool->idle_timeout - (now_ns() - parked);
+            if (left > 0) {
+                struct timespec timeout = {
+                    .tv_sec = left / 1000000000,
+                    .tv_nsec = left % 1000000000,
+                };
+                futex_wait(&self->wakeup, 0, &timeout);
+            } else if (worker_retire(self, word, bit)) {
+                return false;
+            } else {
+                retirable = false;
+            }
+        }
+        atomic_fetch_sub(self->num_idle, 1);
+        relaxed_add(&self->counters.unparks, 1);
+        relaxed_add(&self->counters.idle_time, (uint64_t)(now_ns() - parked));
+
+        if (job_seeking(self, job) == 0) {
+            return true;
+        }
+    }
+}
+
+/**
+ *  Keep seeking for a while before parking: spin, then yield the CPU.
+ *
+ *  Called with the worker counted in num_spinning, so submitters leave
+ *  the parked ones alone meanwhile. The spin budget moves towards twice
+ *  the recent gaps between jobs, and back to the minimum when jobs come
+ *  too rarely for spinning to pay off.
+ */
+STATIC bool worker_idle(struct worker *self, struct job_entry *job)
+{
+    struct thread_pool *pool = self->pool;
+
+    if (pool->busy_poll) {
+        while (!atomic_load_explicit(&pool->stopping, memory_order_relaxed)) {
+            cpu_relax();
+            if (job_seeking(self, job) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int64_t begin = now_ns();
+    bool found = false;
+    do {
+        for (int i = 0; i < 16; ++i) {
+            cpu_relax();
+        }
+        found = (job_seeking(self, job) == 0);
+    } while (!found && ((now_ns() - begin) < self->spin_ns));
+    for (int i = 0; !found && (i < IDLE_YIELDS); ++i) {
+        thrd_yield();
+        found = (job_seeking(self, job) == 0);
+    }
+    if (!found && !worker_park(self, job)) {
+        return false;
+    }
+
+    int64_t gap = now_ns() - begin;
+    int64_t target = IDLE_SPIN_MIN_NS;
+    if (gap <= IDLE_SPIN_MAX_NS) {
+        target = (gap * 2 < IDLE_SPIN_MAX_NS) ? (gap * 2) : IDLE_SPIN_MAX_NS;
+        target = (target > IDLE_SPIN_MIN_NS) ? target : IDLE_SPIN_MIN_NS;
+    }
+    self->spin_ns += (target - self->spin_ns) / 4;
+
+    return true;
+}
+
+STATIC void job_group_complete(struct thread_pool_group *grp)
+{
+    if (atomic_fetch_sub(&grp->pending, 1) == 1) {
+        atomic_fetch_add(&grp->done, 1);
+        futex_wake(&grp->done, INT_MAX);
+    }
+}
+
+/**
+ *  Account for @c num jobs that ran or were dropped.
+ */
+STATIC void job_pending_done(struct thread_pool *self, size_t num)
+{
+    /* Pairs with pool_wait_idle, which announces itself before checking. */
+    if ((atomic_fetch_sub(&self->num_pending, num) == num)
+        && (atomic_load(&self->idle_waiters) != 0)) {
+        atomic_fetch_add(&self->idle_seq, 1);
+        futex_wake(&self->idle_seq, INT_MAX);
+    }
+}
+
+/**
+ *  Account for @c num new jobs, refused once the pool is closing unless
+ *  a job of its own submits them.
+ */
+STATIC int job_pending_add(struct thread_pool *self, size_t num)
+{
+    /* Counted before the check, pairs with thrdpool_shutdown. */
+    atomic_fetch_add(&self->num_pending, num);
+    if (atomic_load(&self->closing) && ((ctx == NULL) || (ctx->pool != self))) {
+        job_pending_done(self, num);
+        errno = ESHUTDOWN;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ *  Settle a job that will never run.
+ */
+STATIC void job_discard(struct thread_pool *self, struct job_entry *job, int error)
+{
+    struct thread_pool_group *grp = job_entry_group(job);
+
+    if (job->dtor != NULL) {
+        job->dtor(job_entry_arg(job));
+    }
+    job_entry_release(self, job);
+    if (job->waitable) {
+        job_record_complete(job->done, error, 0, 0);
+    }
+    if (grp != NULL) {
+        job_group_complete(grp);
+    }
+    job_pending_done(self, 1);
+}
+
+static inline size_t histo_bucket(uint64_t value)
+{
+    if (value < HISTO_SUB_BUCKETS) {
+        return (size_t)value;
+    }
+    if (value >= (UINT64_C(1) << HISTO_MAX_BITS)) {
+        value = (UINT64_C(1) << HISTO_MAX_BITS) - 1;
+    }
+
+    int exp = 63 - __builtin_clzll(value);
+    return ((size_t)(exp - HISTO_SUB_BITS + 1) << HISTO_SUB_BITS)
+           + ((value >> (exp - HISTO_SUB_BITS)) & (HISTO_SUB_BUCKETS - 1));
+}
+
+static inline int64_t histo_bucket_lower(size_t index)
+{
+    if (index < HISTO_SUB_BUCKETS) {
+        return (int64_t)index;
+    }
+
+    int exp = (int)(index >> HISTO_SUB_BITS) + HISTO_SUB_BITS - 1;
+    uint64_t sub = index & (HISTO_SUB_BUCKETS - 1);
+    return (int64_t)((HISTO_SUB_BUCKETS + sub) << (exp - HISTO_SUB_BITS));
+}
+
+STATIC void histo_record(struct job_histo *histo, int64_t elapsed)
+{
+    uint64_t value = (elapsed > 0) ? (uint64_t)elapsed : 0;
+
+    relaxed_add(&histo->buckets[histo_bucket(value)], 1);
+    relaxed_add(&histo->total, value);
+    if (value > atomic_load_explicit(&histo->max, memory_order_relaxed)) {
+        atomic_store_explicit(&histo->max, value, memory_order_relaxed);
+    }
+    relaxed_add(&histo->count, 1);
+}
+
+/**
+ *  Find or claim the worker's profile for a job name.
+ *
+ *  Names beyond the table share the last entry, reported as unnamed.
+ */
+STATIC struct job_profile *job_profile_lookup(struct worker *self, uint16_t name)
+{
+    for (size_t i = 0; i < PROFILE_NAMES; ++i) {
+        struct job_profile *prof = &self->profiles[(name + i) % PROFILE_NAMES];
+        if (!atomic_load_explicit(&prof->used, memory_order_relaxed)) {
+            prof->name = name;
+            atomic_store_explicit(&prof->used, true, memory_order_release);
+            return prof;
+        }
+        if (prof->name == name) {
+            return prof;
+        }
+    }
+
+    struct job_profile *prof = &self->profiles[PROFILE_NAMES];
+    atomic_store_explicit(&prof->used, true, memory_order_release);
+    return prof;
+}
+
+STATIC void job_profile_record(struct worker *self, const struct job_entry *job,
+                               int64_t start_time, int64_t end_time)
+{
+    struct job_profile *prof = job_profile_lookup(self, job->name);
+
+    if (job->submit_time != 0) {
+        histo_record(&prof->wait, start_time - job->submit_time);
+    }
+    histo_record(&prof->run, end_time - start_time);
+}
+
+/**
+ *  Publish the running job, or idleness if @c job is NULL.
+ */
+STATIC void job_view_publish(struct worker *self, const struct job_entry *job)
+{
+    struct job_view *view = &self->view;
+    uint32_t seq = atomic_load_explicit(&view->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&view->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&view->running, job != NULL, memory_order_relaxed);
+    if (job != NULL) {
+        atomic_store_explicit(&view->id, job->id, memory_order_relaxed);
+        atomic_store_explicit(&view->name, job->name, memory_order_relaxed);
+    }
+    atomic_store_explicit(&view->seq, seq + 2, memory_order_release);
+}
+
+STATIC void job_view_read(struct job_view *view, twstats_t *stats)
+{
+    uint32_t seq;
+    uint16_t name;
+
+    do {
+        seq = atomic_load_explicit(&view->seq, memory_order_acquire);
+        stats->running = atomic_load_explicit(&view->running, memory_order_relaxed);
+        stats->job_id = atomic_load_explicit(&view->id, memory_order_relaxed);
+        name = atomic_load_explicit(&view->name, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while (((seq & 1) != 0) || (seq != atomic_load_explicit(&view->seq, memory_order_relaxed)));
+
+    if (!stats->running) {
+        stats->job_id = 0;
+        name = 0;
+    }
+    memset(stats->job_name, 0, sizeof(stats->job_name));
+    strncpy(stats->job_name, job_name_lookup(name), sizeof(stats->job_name) - 1);
+}
+
+/**
+ *  Run a job on the worker, also used to help while waiting for a group.
+ */
+STATIC void job_run(struct worker *self, struct job_entry *job)
+{
+    struct thread_pool_tenant *tenant = self->picked_tenant;
+    self->picked_tenant = NULL;
+    struct thread_pool_cancel *cancel = job_entry_cancel(job);
+    if ((cancel != NULL) && atomic_load_explicit(&cancel->requested, memory_order_acquire)) {
+        relaxed_add(&self->counters.cancelled, 1);
+        job_discard(self->pool, job, -ECANCELED);
+        return;
+    }
+
+    struct thread_pool_cancel *outer_cancel = self->cancel;
+    struct job_entry *outer = self->current;
+    const char *outer_label = thrdpool_job_label;
+    int64_t outer_deadline = self->deadline;
+    self->current = job;
+    self->deadline = self->picked;
+    self->cancel = cancel;
+    job_view_publish(self, job);
+    if (job->name != 0) {
+        thrdpool_job_label = job_name_lookup(job->name);
+        if (self->pool->thread_names) {
+            thrd_set_name(self->thr, thrdpool_job_label);
+        }
+    } else {
+        thrdpool_job_label = NULL;
+    }
+    /* The record may be reused as soon as it completes. */
+    struct thread_pool_group *grp = job_entry_group(job);
+    void *arg = job_entry_arg(job);
+    atomic_fetch_add(self->num_active, 1);
+    if (job->waitable || (self->profiles != NULL) || (tenant != NULL)) {
+        int64_t start_time = now_ns();
+        int ret = job->func(arg);
+        int64_t end_time = now_ns();
+        if (job->dtor != NULL) {
+            job->dtor(arg);
+        }
+        job_entry_release(self->pool, job);
+        if (job->waitable) {
+            job_record_complete(job->done, ret, start_time, end_time);
+        }
+        if (self->profiles != NULL) {
+            job_profile_record(self, job, start_time, end_time);
+        }
+        if (tenant != NULL) {
+            tenant_charge(self, tenant, end_time - start_time);
+        }
+    } else {
+        job->func(arg);
+        if (job->dtor != NULL) {
+            job->dtor(arg);
+        }
+        job_entry_release(self->pool, job);
+    }
+    atomic_fetch_sub(self->num_active, 1);
+    thrdpool_job_label = outer_label;
+    if ((job->name != 0) && self->pool->thread_names) {
+        thrd_set_name(self->thr, (outer_label != NULL) ? outer_label : self->name);
+    }
+    relaxed_add(&self->counters.executed, 1);
+    self->current = outer;
+    self->deadline = outer_deadline;
+    self->cancel = outer_cancel;
+    job_view_publish(self, outer);
+    if (grp != NULL) {
+        job_group_complete(grp);
+    }
+    job_pending_done(self->pool, 1);
+}
+
+STATIC int worker(void *arg)
+{
+    SELFLIZE(struct worker *, arg);
+
+    ctx = self;
+
+    snprintf(self->name, sizeof(self->name), "worker[%d]", self->wid);
+    thrd_set_name(thrd_current(), self->name);
+
+    if (self->cpu >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(self->cpu, &cpuset);
+        thrd_set_affinity(thrd_current(), &cpuset);
+    } else if (self->pool->placement == THRDPOOL_PLACE_CPUSET) {
+        thrd_set_affinity(thrd_current(), &self->pool->cpuset);
+    }
+
+    atomic_fetch_add(&self->pool->num_spinning, 1);
+    while (true) {
+        struct job_entry job;
+
+        if ((job_seeking(self, &job) != 0) && !worker_idle(self, &job)) {
+            break;
+        }
+        /* The last spinner to find work hands the search over. */
+        if (atomic_fetch_sub(&self->pool->num_spinning, 1) == 1) {
+            worker_wakeup(self->pool);
+        }
+
+        job_run(self, &job);
+        atomic_fetch_add(&self->pool->num_spinning, 1);
+    }
+
+    return 0;
+}
+
+/**
+ *  Start a worker in a free elastic slot, unless @c limit are alive.
+ */
+STATIC bool worker_spawn(struct thread_pool *self, size_t limit)
+{
+    size_t alive = atomic_load(&self->num_alive);
+    do {
+        if (alive >= limit) {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak(&self->num_alive, &alive, alive + 1));
+
+    for (size_t i = self->min_workers; i < self->num_workers; ++i) {
+        struct worker *w = &self->workers[i];
+        enum worker_state state = INIT;
+        if (!atomic_compare_exchange_strong(&w->status, &state, IDLE)) {
+            continue;
+        }
+        if (atomic_load(&self->stopping)) {
+            /* The slot may already have been passed over by worker_stop_all(). */
+            atomic_store(&w->status, INIT);
+            break;
+        }
+        if (thrd_create(&w->thr, worker, w) != 0) {
+            atomic_store(&w->status, INIT);
+            break;
+        }
+        return true;
+    }
+    atomic_fetch_sub(&self->num_alive, 1);
+
+    return false;
+}
+
+/**
+ *  Add a worker if every live one is busy and the backlog is deep enough.
+ */
+STATIC void worker_grow(struct thread_pool *self)
+{
+    if ((self->min_workers == self->max_workers) || (atomic_load(&self->num_idle) != 0)
+        || atomic_load(&self->stopping)) {
+        return;
+    }
+
+    size_t depth = 0;
+    if ((ctx != NULL) && (ctx->pool == self)) {
+        depth = worker_local_depth(ctx);
+    } else if (self->edf) {
+        for (size_t i = 0; i < self->num_workers; ++i) {
+            depth += worker_local_depth(&self->workers[i]);
+        }
+    } else {
+        depth = pool_global_depth(self);
+    }
+    if (depth >= self->grow_threshold) {
+        worker_spawn(self, self->max_workers);
+    }
+}
+
+/**
+ *  Wake or start a worker for each one blocked past the threshold, up to
+ *  the spares, while jobs are waiting. Jobs left on the deques of the
+ *  blocked workers count, as only a thief can run them now.
+ */
+STATIC void blocking_compensate(struct thread_pool *self)
+{
+    struct blocking_monitor *mon = &self->monitor;
+    int64_t now = now_ns();
+    size_t stalled = 0;
+    size_t depth = pool_global_depth(self);
+
+    for (size_t i = 0; i < self->num_workers; ++i) {
+        struct worker *w = &self->workers[i];
+        int64_t since = atomic_load(&w->blocked_since);
+        if ((since != 0) && ((now - since) >= mon->threshold)) {
+            ++stalled;
+            depth += worker_local_depth(w);
+        }
+    }
+    stalled = (stalled < mon->max_spare) ? stalled : mon->max_spare;
+
+    /* Counting the blocked ones, no more than max_workers keep running. */
+    size_t limit = self->max_workers + stalled;
+    for (size_t i = 0; (i < stalled) && (i < depth); ++i) {
+        if (atomic_load(&self->num_spinning) != 0) {
+            /* Someone is looking for jobs already. */
+            break;
+        }
+        if (!worker_wakeup(self) && !worker_spawn(self, limit)) {
+            break;
+        }
+        relaxed_add(&mon->compensations, 1);
+    }
+}
+
+STATIC int blocking_monitor(void *arg)
+{
+    SELFLIZE(struct thread_pool *, arg);
+    struct blocking_monitor *mon = &self->monitor;
+    struct timespec period = {
+        .tv_sec = (mon->threshold / 2) / 1000000000,
+        .tv_nsec = (mon->threshold / 2) % 1000000000,
+    };
+
+    thrd_set_name(thrd_current(), "monitor");
+    while (atomic_load(&mon->started)) {
+        uint32_t seen = atomic_load(&mon->wakeup);
+        if (atomic_load(&self->num_blocked) == 0) {
+            futex_wait(&mon->wakeup, seen, NULL);
+            continue;
+        }
+        blocking_compensate(self);
+        futex_wait(&mon->wakeup, seen, &period);
+    }
+
+    return 0;
+}
+
+static inline void blocking_kick(struct blocking_monitor *mon)
+{
+    atomic_fetch_add(&mon->wakeup, 1);
+    futex_wake(&mon->wakeup, 1);
+}
+
+/**
+ *  Start the monitor on the first blocking job, once per pool.
+ */
+STATIC void blocking_monitor_start(struct thread_pool *self)
+{
+    struct blocking_monitor *mon = &self->monitor;
+
+    pthread_mutex_lock(&mon->lock);
+    if (!atomic_load(&mon->started) && !mon->closed) {
+        atomic_store(&mon->started, true);
+        if (thrd_create(&mon->thr, blocking_monitor, self) != 0) {
+            atomic_store(&mon->started, false);
+        }
+    }
+    pthread_mutex_unlock(&mon->lock);
+}
+
+STATIC void blocking_monitor_stop(struct blocking_monitor *mon)
+{
+    pthread_mutex_lock(&mon->lock);
+    bool started = atomic_exchange(&mon->started, false);
+    mon->closed = true;
+    pthread_mutex_unlock(&mon->lock);
+
+    if (started) {
+        blocking_kick(mon);
+        thrd_join(mon->thr, NULL);
+    }
+}
+
+STATIC int timer_wheel_init(struct timer_wheel *wheel)
+{
+    if (mempool_create(&wheel->entries, sizeof(struct thread_pool_timer), MAX_JOBS) != 0) {
+        return -1;
+    }
+    mempool_set_growable(&wheel->entries, true);
+    pthread_mutex_init(&wheel->lock, NULL);
+    wheel->epoch = now_ns();
+    atomic_init(&wheel->wakeup, 0);
+
+    return 0;
+}
+
+STATIC void timer_wheel_destroy(struct timer_wheel *wheel)
+{
+    pthread_mutex_destroy(&wheel->lock);
+    mempool_destroy(&wheel->entries);
+}
+
+static inline uint64_t timer_now(const struct timer_wheel *wheel)
+{
+    return (uint64_t)(now_ns() - wheel->epoch) / TIMER_TICK_NS;
+}
+
+static inline void timer_kick(struct timer_wheel *wheel)
+{
+    atomic_fetch_add(&wheel->wakeup, 1);
+    futex_wake(&wheel->wakeup, 1);
+}
+
+/**
+ *  Link a timer into the slot covering its expiry, O(1).
+ *
+ *  Must be called with the wheel locked.
+ */
+STATIC void timer_link(struct timer_wheel *wheel, struct thread_pool_timer *tmr)
+{
+    uint64_t expires = (tmr->expires < wheel->current) ? wheel->current : tmr->expires;
+    uint64_t delta = expires - wheel->current;
+    int level = 0;
+    while ((level < (TIMER_WHEEL_LEVELS - 1))
+           && (delta >= (UINT64_C(1) << (TIMER_WHEEL_BITS * (level + 1))))) {
+        ++level;
+    }
+    uint64_t span = UINT64_C(1) << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+    if (delta >= span) {
+        /* Beyond the outermost level, park it there and cascade again later. */
+        expires = wheel->current + span - 1;
+    }
+
+    size_t index = (expires >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+    struct thread_pool_timer **slot = &wheel->slots[level][index];
+    tmr->slot = slot;
+    tmr->prev = NULL;
+    tmr->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->prev = tmr;
+    }
+    *slot = tmr;
+}
+
+STATIC void timer_unlink(struct thread_pool_timer *tmr)
+{
+    if (tmr->prev != NULL) {
+        tmr->prev->next = tmr->next;
+    } else {
+        *tmr->slot = tmr->next;
+    }
+    if (tmr->next != NULL) {
+        tmr->next->prev = tmr->prev;
+    }
+    tmr->slot = NULL;
+}
+
+STATIC void timer_free(struct timer_wheel *wheel, struct thread_pool_timer *tmr)
+{
+    atomic_fetch_add(&tmr->gen, 1);
+    mempool_free(&wheel->entries, tmr);
+    --wheel->num_timers;
+}
+
+/**
+ *  Due jobs of one priority level.
+ */
+struct timer_batch {
+    struct job_entry jobs[TIMER_BATCH];
+    int64_t deadlines[TIMER_BATCH]; /* Used in deadline mode. */
+    size_t num;
+};
+
+/**
+ *  Hand due jobs to the global queue in one batch, false if a bounded
+ *  queue has no room for them and they are still in @c batch.
+ */
+STATIC bool timer_dispatch(struct thread_pool *self, int level, struct timer_batch *batch)
+{
+    size_t num = batch->num;
+    if (num == 0) {
+        return true;
+    }
+
+    juid_t id = atomic_fetch_add(&juid, (juid_t)num);
+    int64_t submit_time = self->profiling ? now_ns() : 0;
+    for (size_t i = 0; i < num; ++i) {
+        batch->jobs[i].id = id + (juid_t)i;
+        batch->jobs[i].submit_time = submit_time;
+    }
+    atomic_fetch_add(&self->num_pending, num);
+    pool_use_level(self, level);
+    if ((self->edf ? edf_push(self, batch->jobs, batch->deadlines, num)
+                   : queue_enqueue_batch(&self->jobs[level], batch->jobs, num)) != 0) {
+        job_pending_done(self, num);
+        return false;
+    }
+    batch->num = 0;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    worker_wakeup_many(self, num);
+    worker_grow(self);
+
+    return true;
+}
+
+/**
+ *  Drop due jobs that never found room, once the pool is closing.
+ */
+STATIC void timer_batch_discard(struct thread_pool *self, struct timer_batch *batch)
+{
+    atomic_fetch_add(&self->num_pending, batch->num);
+    for (size_t i = 0; i < batch->num; ++i) {
+        job_discard(self, &batch->jobs[i], -ECANCELED);
+    }
+    batch->num = 0;
+}
+
+/**
+ *  Process one tick: cascade outer levels, then move due jobs to @c batch.
+ *
+ *  Stops short when a batch is full or an argument cannot be boxed,
+ *  leaving the rest of the tick linked, so the caller can dispatch
+ *  unlocked and run the tick again.
+ *  Must be called with the wheel locked.
+ */
+STATIC bool timer_tick(struct thread_pool *self, struct timer_batch *batch)
+{
+    struct timer_wheel *wheel = &self->timers;
+    uint64_t tick = wheel->current;
+
+    for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; --level) {
+        uint64_t mask = (UINT64_C(1) << (TIMER_WHEEL_BITS * level)) - 1;
+        if ((tick & mask) != 0) {
+            continue;
+        }
+        size_t index = (tick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+        struct thread_pool_timer *tmr = wheel->slots[level][index];
+        wheel->slots[level][index] = NULL;
+        while (tmr != NULL) {
+            struct thread_pool_timer *next = tmr->next;
+            timer_link(wheel, tmr);
+            tmr = next;
+        }
+    }
+
+    struct thread_pool_timer **slot = &wheel->slots[0][tick & (TIMER_WHEEL_SLOTS - 1)];
+    struct thread_pool_timer *tmr = *slot;
+    *slot = NULL;
+    while (tmr != NULL) {
+        struct thread_pool_timer *next = tmr->next;
+        if (tmr->expires > tick) {
+            /* Clamped to the outermost level, not yet due. */
+            timer_link(wheel, tmr);
+        } else {
+            int level = tmr->job.priority;
+            size_t i = batch[level].num;
+            struct job_entry *entry = &batch[level].jobs[i];
+            if ((i == TIMER_BATCH) || (job_entry_make(self, entry, &tmr->job, 0) != 0)) {
+                while (tmr != NULL) {
+                    next = tmr->next;
+                    timer_link(wheel, tmr);
+                    tmr = next;
+                }
+                return false;
+            }
+            ++batch[level].num;
+            batch[level].deadlines[i] = job_deadline(self, &tmr->job);
+            if (tmr->period > 0) {
+                /* Every firing runs on a copy, the timer keeps the argument. */
+                entry->dtor = NULL;
+                tmr->expires = tick + tmr->period;
+                timer_link(wheel, tmr);
+            } else {
+                timer_free(wheel, tmr);
+            }
+        }
+        tmr = next;
+    }
+
+    wheel->current = tick + 1;
+
+    return true;
+}
+
+/**
+ *  Next tick worth waking up for, the next busy inner slot
+ *  or the next cascade.
+ */
+STATIC uint64_t timer_next(const struct timer_wheel *wheel)
+{
+    if (wheel->num_timers == 0) {
+        return UINT64_MAX;
+    }
+
+    uint64_t tick = wheel->current;
+    do {
+        if (wheel->slots[0][tick & (TIMER_WHEEL_SLOTS - 1)] != NULL) {
+            return tick;
+        }
+        ++tick;
+    } while ((tick & (TIMER_WHEEL_SLOTS - 1)) != 0);
+
+    return tick;
+}
+
+STATIC int timer_thread(void *arg)
+{
+    SELFLIZE(struct thread_pool *, arg);
+    struct timer_wheel *wheel = &self->timers;
+    struct timer_batch batch[THRDPOOL_PRIORITIES] = {0};
+
+    thrd_set_name(thrd_current(), "timer");
+    while (!atomic_load(&self->closing)) {
+        uint32_t seen = atomic_load(&wheel->wakeup);
+
+        pthread_mutex_lock(&wheel->lock);
+        uint64_t now = timer_now(wheel);
+        bool full = false;
+        while (!full && (wheel->current <= now)) {
+            full = !timer_tick(self, batch);
+        }
+        /* A full batch leaves the current tick due, so there is no sleep. */
+        uint64_t next = full ? wheel->current : timer_next(wheel);
+        wheel->sleep_until = next;
+        pthread_mutex_unlock(&wheel->lock);
+
+        bool stalled = false;
+        for (int level = 0; level < THRDPOOL_PRIORITIES; ++level) {
+            stalled |= !timer_dispatch(self, level, &batch[level]);
+        }
+
+        if (stalled) {
+            /* A bounded queue is full, retry in a tick unless the wheel is stopped. */
+            struct timespec timeout = {
+                .tv_sec = 0,
+                .tv_nsec = TIMER_TICK_NS,
+            };
+            futex_wait(&wheel->wakeup, seen, &timeout);
+        } else if (next == UINT64_MAX) {
+            futex_wait(&wheel->wakeup, seen, NULL);
+        } else {
+            int64_t ns = (int64_t)(next * TIMER_TICK_NS) + wheel->epoch - now_ns();
+            if (ns > 0) {
+                struct timespec timeout = {
+                    .tv_sec = ns / 1000000000,
+                    .tv_nsec = ns % 1000000000,
+                };
+                futex_wait(&wheel->wakeup, seen, &timeout);
+            }
+        }
+    }
+    for (int level = 0; level < THRDPOOL_PRIORITIES; ++level) {
+        timer_batch_discard(self, &batch[level]);
+    }
+
+    return 0;
+}
+
+STATIC void timer_wheel_stop(struct timer_wheel *wheel)
+{
+    pthread_mutex_lock(&wheel->lock);
+    bool started = wheel->started;
+    wheel->started = false;
+    pthread_mutex_unlock(&wheel->lock);
+
+    if (started) {
+        timer_kick(wheel);
+        thrd_join(wheel->thr, NULL);
+    }
+}
+
+/**
+ *  Drop every armed timer, waitable ones complete with -ECANCELED.
+ *
+ *  Must be called after the timer thread has stopped.
+ */
+STATIC void timer_wheel_discard(struct timer_wheel *wheel)
+{
+    for (size_t level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        for (size_t i = 0; i < TIMER_WHEEL_SLOTS; ++i) {
+            while (true) {
+                pthread_mutex_lock(&wheel->lock);
+                struct thread_pool_timer *tmr = wheel->slots[level][i];
+                if (tmr == NULL) {
+                    pthread_mutex_unlock(&wheel->lock);
+                    break;
+                }
+                job_t job = tmr->job;
+                timer_unlink(tmr);
+                timer_free(wheel, tmr);
+                pthread_mutex_unlock(&wheel->lock);
+
+                job_release_arg(&job);
+                if (job.handle.rec != NULL) {
+                    job_record_complete(job.handle.rec, -ECANCELED, 0, 0);
+                }
+            }
+        }
+    }
+}
+
+/**
+ *  Arm a timer for @c job, @c delay and @c period are in ticks.
+ */
+STATIC int timer_add(struct thread_pool *self, job_t *job, uint64_t delay, uint64_t period)
+{
+    struct timer_wheel *wheel = &self->timers;
+
+    if (job_record_acquire(self, job) != 0) {
+        return -1;
+    }
+    struct thread_pool_timer *tmr = mempool_alloc(&wheel->entries);
+    if (tmr == NULL) {
+        if (job->handle.rec != NULL) {
+            job_record_free(job->handle.rec);
+            job->handle = (jhandle_t){0};
+        }
+        return -1;
+    }
+    tmr->job = *job;
+    tmr->job.waitable = false; /* The record is attached already. */
+    tmr->wheel = wheel;
+    tmr->period = period;
+
+    pthread_mutex_lock(&wheel->lock);
+    if (atomic_load(&self->closing)) {
+        /* Checked under the lock, so timer_wheel_stop() cannot miss a new thread. */
+        pthread_mutex_unlock(&wheel->lock);
+        mempool_free(&wheel->entries, tmr);
+        if (job->handle.rec != NULL) {
+            job_record_free(job->handle.rec);
+            job->handle = (jhandle_t){0};
+        }
+        errno = ESHUTDOWN;
+        return -1;
+    }
+    if (!wheel->started) {
+        wheel->sleep_until = UINT64_MAX;
+        if (thrd_create(&wheel->thr, timer_thread, self) != 0) {
+            pthread_mutex_unlock(&wheel->lock);
+            mempool_free(&wheel->entries, tmr);
+            if (job->handle.rec != NULL) {
+                job_record_free(job->handle.rec);
+                job->handle = (jhandle_t){0};
+            }
+            return -1;
+        }
+        wheel->started = true;
+    }
+    /* Round up, a timer never fires early. */
+    tmr->expires = timer_now(wheel) + delay + 1;
+    timer_link(wheel, tmr);
+    ++wheel->num_timers;
+    bool kick = (tmr->expires < wheel->sleep_until);
+    if (kick) {
+        wheel->sleep_until = tmr->expires;
+    }
+    job->timer = (thandle_t){
+        .tmr = tmr,
+        .gen = atomic_load(&tmr->gen),
+    };
+    if (!job->waitable) {
+        job->handle = (jhandle_t){0};
+    }
+    pthread_mutex_unlock(&wheel->lock);
+
+    if (kick) {
+        timer_kick(wheel);
+    }
+
+    return 0;
+}
+
+int thrdpool_attr_init(tpool_attr_t *attr, size_t num_workers)
+{
+    if ((attr == NULL) || (num_workers == 0) || (num_workers > MAX_THREADS)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *attr = (tpool_attr_t){
+        .num_workers = num_workers,
+        .capacity = THRDPOOL_UNBOUNDED,
+        .profiling = false,
+        .busy_poll = false,
+        .thread_names = false,
+        .deadline_mode = false,
+        .drop_expired = false,
+        .placement = THRDPOOL_PLACE_NONE,
+        .max_workers = num_workers,
+        .grow_threshold = 1,
+        .idle_timeout = 1000,
+        .max_spare = 0,
+        .blocking_threshold = 0,
+    };
+
+    return 0;
+}
+
+int thrdpool_attr_set_capacity(tpool_attr_t *attr, size_t capacity)
+{
+    if (attr == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    attr->capacity = capacity;
+
+    return 0;
+}
+
+int thrdpool_attr_set_placement(tpool_attr_t *attr, enum thrdpool_placement placement,
+                                const cpu_set_t *cpuset)
+{
+    if ((attr == NULL) || (placement < THRDPOOL_PLACE_NONE) || (placement > THRDPOOL_PLACE_CPUSET)
+        || ((placement == THRDPOOL_PLACE_CPUSET) && ((cpuset == NULL) || (CPU_COUNT(cpuset) == 0)))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    attr->placement = placement;
+    if (placement == THRDPOOL_PLACE_CPUSET) {
+        attr->cpuset = *cpuset;
+    }
+
+    return 0;
+}
+
+/**
+ *  Sort key of a CPU, compared field by field.
+ */
+struct placement_key {
+    int key[4];
+    int cpu;
+};
+
+static int placement_compare(const void *lhs, const void *rhs)
+{
+    const struct placement_key *l = (const struct placement_key *)lhs;
+    const struct placement_key *r = (const struct placement_key *)rhs;
+
+    for (size_t i = 0; i < (sizeof(l->key) / sizeof(l->key[0])); ++i) {
+        if (l->key[i] != r->key[i]) {
+            return (l->key[i] < r->key[i]) ? -1 : 1;
+        }
+    }
+    return (l->cpu < r->cpu) ? -1 : (l->cpu > r->cpu);
+}
+
+/**
+ *  Pin each worker to one CPU.
+ *
+ *  Compact fills SMT siblings, then cores sharing a last-level cache,
+ *  then the next cache group. Scatter takes one core from each cache
+ *  group and node in turn, using SMT siblings last.
+ *  Workers stay unpinned if the topology can't be probed.
+ */
+STATIC void placement_assign(struct thread_pool *self)
+{
+    cpu_topo_t *topo = malloc(sizeof(*topo));
+    if ((topo == NULL) || (thrd_get_topology(topo) != 0) || (topo->num_cpus == 0)) {
+        free(topo);
+        return;
+    }
+    struct placement_key *keys = calloc(topo->num_cpus, sizeof(*keys));
+    if (keys == NULL) {
+        free(topo);
+        return;
+    }
+
+    for (size_t i = 0; i < topo->num_cpus; ++i) {
+        const struct cpu_info *info = &topo->cpus[i];
+        struct placement_key *k = &keys[i];
+        k->cpu = info->cpu;
+        if (self->placement == THRDPOOL_PLACE_COMPACT) {
+            k->key[0] = info->node;
+            k->key[1] = info->llc;
+            k->key[2] = info->core;
+            k->key[3] = info->smt;
+            continue;
+        }
+
+        /* Ranks of the core within its cache group and of the group within its node. */
+        int core_rank = 0;
+        for (size_t j = 0; j < topo->num_cpus; ++j) {
+            const struct cpu_info *other = &topo->cpus[j];
+            if ((other->smt == 0) && (other->llc == info->llc) && (other->core < info->core)) {
+                ++core_rank;
+            }
+        }
+        int llc_rank = 0;
+        for (int llc = 0; llc < info->llc; ++llc) {
+            for (size_t j = 0; j < topo->num_cpus; ++j) {
+                if ((topo->cpus[j].llc == llc) && (topo->cpus[j].node == info->node)) {
+                    ++llc_rank;
+                    break;
+                }
+            }
+        }
+        k->key[0] = info->smt;
+        k->key[1] = core_rank;
+        k->key[2] = llc_rank;
+        k->key[3] = info->node;
+    }
+    qsort(keys, topo->num_cpus, sizeof(*keys), placement_compare);
+
+    for (size_t i = 0; i < self->num_workers; ++i) {
+        self->workers[i].cpu = keys[i % topo->num_cpus].cpu;
+    }
+    free(keys);
+    free(topo);
+}
+
+int thrdpool_attr_set_elastic(tpool_attr_t *attr, size_t max_workers,
+                              size_t grow_threshold, uint64_t idle_timeout)
+{
+    if ((attr == NULL) || (max_workers < attr->num_workers) || (max_workers > MAX_THREADS)
+        || (grow_threshold == 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    attr->max_workers = max_workers;
+    attr->grow_threshold = grow_threshold;
+    attr->idle_timeout = idle_timeout;
+
+    return 0;
+}
+
+int thrdpool_attr_set_compensation(tpool_attr_t *attr, size_t max_spare, uint64_t threshold)
+{
+    if ((attr == NULL) || (max_spare > MAX_THREADS) || ((max_spare != 0) && (threshold == 0))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    attr->max_spare = max_spare;
+    attr->blocking_threshold = threshold;
+
+    return 0;
+}
+
+int thrdpool_attr_set_profiling(tpool_attr_t *attr, bool profiling)
+{
+    if (attr == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    attr->profiling = profiling;
+
+    return 0;
+}
+
+int thrdpool_attr_set_busy_poll(tpool_attr_t *attr, bool busy_poll)
+{
+    if (attr == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    attr->busy_poll = busy_poll;
+
+    return 0;
+}
+
+int thrdpool_attr_set_thread_names(tpool_attr_t *attr, bool thread_names)
+{
+    if (attr == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    attr->thread_names = thread_names;
+
+    return 0;
+}
+
+int thrdpool_attr_set_deadline_mode(tpool_attr_t *attr, bool deadline_mode, bool drop_expired)
+{
+    if (attr == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    attr->deadline_mode = deadline_mode;
+    attr->drop_expired = drop_expired;
+
+    return 0;
+}
+
+STATIC int worker_creator(void *arg)
+{
+    SELFLIZE(struct thread_pool *, arg);
+
+    for (size_t i = 1; i < self->min_workers; ++i) {
+        struct worker *w = &self->workers[i];
+
+        atomic_store(&w->status, IDLE);
+        if (thrd_create(&w->thr, worker, w) != 0) {
+            atomic_store(&w->status, FAIL);
+        } else {
+            atomic_fetch_add(&self->num_alive, 1);
+        }
+    }
+    promise_set_value(&self->prms, 0);
+
+    return worker(&self->workers[0]);
+}
+
+tpool_t thrdpool_create(size_t num_workers)
+{
+    tpool_attr_t attr;
+    if (thrdpool_attr_init(&attr, num_workers) != 0) {
+        return NULL;
+    }
+
+    return thrdpool_create_attr(&attr);
+}
+
+STATIC int pool_queues_create(struct thread_pool *self, size_t capacity, bool growable)
+{
+    for (int level = 0; level < THRDPOOL_PRIORITIES; ++level) {
+        if (queue_create(&self->jobs[level], sizeof(struct job_entry), capacity) != 0) {
+            while (--level >= 0) {
+                queue_destroy(&self->jobs[level]);
+            }
+            return -1;
+        }
+        queue_set_growable(&self->jobs[level], growable);
+    }
+
+    return 0;
+}
+
+STATIC void pool_queues_destroy(struct thread_pool *self)
+{
+    for (int level = 0; level < THRDPOOL_PRIORITIES; ++level) {
+        queue_destroy(&self->jobs[level]);
+    }
+}
+
+STATIC int worker_deques_create(struct worker *self, size_t capacity, bool growable)
+{
+    for (int level = 0; level < THRDPOOL_PRIORITIES; ++level) {
+        if (deque_create(&self->local_jobs[level], sizeof(struct job_entry), capacity) != 0) {
+            while (--level >= 0) {
+                deque_destroy(&self->local_jobs[level]);
+            }
+            return -1;
+        }
+        deque_set_growable(&self->local_jobs[level], growable);
+    }
+    size_t index = self->wid - 1;
+    if (self->pool->edf
+        && (edf_shard_init(&self->edf, capacity, growable,
+                           &self->pool->edf_busy[index / IDLE_MASK_BITS],
+                           UINT64_C(1) << (index % IDLE_MASK_BITS)) != 0)) {
+        for (int level = 0; level < THRDPOOL_PRIORITIES; ++level) {
+            deque_destroy(&self->local_jobs[level]);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+STATIC void worker_deques_destroy(struct worker *self)
+{
+    for (int level = 0; level < THRDPOOL_PRIORITIES; ++level) {
+        deque_destroy(&self->local_jobs[level]);
+    }
+    edf_shard_destroy(&self->edf);
+}
+
+tpool_t thrdpool_create_attr(const tpool_attr_t *attr)
+{
+    if ((attr == NULL) || (attr->num_workers == 0) || (attr->num_workers > MAX_THREADS)
+        || (attr->max_workers > MAX_THREADS)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    size_t max_workers = (attr->max_workers > attr->num_workers)
+                         ? attr->max_workers : attr->num_workers;
+    size_t num_workers = max_workers + attr->max_spare;
+    if (num_workers > MAX_THREADS) {
+        errno = EINVAL;
+        return NULL;
+    }
+    bool growable = (attr->capacity == THRDPOOL_UNBOUNDED);
+    size_t capacity = growable ? MAX_JOBS : attr->capacity;
+    size_t steal_max = (capacity < STEAL_BATCH) ? capacity : STEAL_BATCH;
+
+    size_t workers_size = sizeof(struct worker) * (num_workers + 1);
+    struct thread_pool *self = aligned_alloc(alignof(struct thread_pool),
+                                             sizeof(*self) + workers_size);
+    if (self == NULL) {
+        return NULL;
+    }
+
+    *self = THREAD_POOL_MAKER(num_workers);
+    self->min_workers = attr->num_workers;
+    self->max_workers = max_workers;
+    self->monitor.threshold = (int64_t)attr->blocking_threshold * 1000000;
+    self->monitor.max_spare = attr->max_spare;
+    self->grow_threshold = attr->grow_threshold;
+    self->idle_timeout = (int64_t)attr->idle_timeout * 1000000;
+    self->edf = attr->deadline_mode;
+    self->drop_expired = attr->drop_expired;
+    if (pool_queues_create(self, capacity, growable) != 0) {
+        free(self);
+        return NULL;
+    }
+    self->capacity = capacity;
+    self->growable = growable;
+    tenant_init(&self->default_tenant, self, &self->jobs[THRDPOOL_PRIO_NORMAL], 1);
+    self->tenants[0] = &self->default_tenant;
+    if (mempool_create(&self->records, sizeof(struct job_record), MAX_JOBS) != 0) {
+        pool_queues_destroy(self);
+        free(self);
+        return NULL;
+    }
+    mempool_set_growable(&self->records, true);
+    if (mempool_create(&self->groups, sizeof(struct thread_pool_group), MAX_JOBS) != 0) {
+        mempool_destroy(&self->records);
+        pool_queues_destroy(self);
+        free(self);
+        return NULL;
+    }
+    mempool_set_growable(&self->groups, true);
+    if (mempool_create(&self->payloads, JOB_INLINE_MAX, MAX_JOBS) != 0) {
+        mempool_destroy(&self->groups);
+        mempool_destroy(&self->records);
+        pool_queues_destroy(self);
+        free(self);
+        return NULL;
+    }
+    mempool_set_growable(&self->payloads, true);
+    if (timer_wheel_init(&self->timers) != 0) {
+        mempool_destroy(&self->payloads);
+        mempool_destroy(&self->groups);
+        mempool_destroy(&self->records);
+        pool_queues_destroy(self);
+        free(self);
+        return NULL;
+    }
+    self->ftr = promise_get_future(&self->prms);
+    for (size_t i = 0; i < num_workers; ++i) {
+        struct worker *w = &self->workers[i];
+        *w = WORKER_MAKER(i + 1, self);
+        if (worker_deques_create(w, capacity, growable) != 0) {
+            for (size_t j = 0; j < i; ++j) {
+                worker_deques_destroy(&self->workers[j]);
+            }
+            timer_wheel_destroy(&self->timers);
+            mempool_destroy(&self->payloads);
+            mempool_destroy(&self->groups);
+            mempool_destroy(&self->records);
+            pool_queues_destroy(self);
+            free(self);
+            return NULL;
+        }
+    }
+    self->profiling = attr->profiling;
+    self->busy_poll = attr->busy_poll;
+    self->thread_names = attr->thread_names;
+    self->steal_max = steal_max;
+    self->placement = attr->placement;
+    if (self->placement == THRDPOOL_PLACE_CPUSET) {
+        self->cpuset = attr->cpuset;
+    } else if (self->placement != THRDPOOL_PLACE_NONE) {
+        placement_assign(self);
+    }
+    for (size_t i = 0; self->profiling && (i < num_workers); ++i) {
+        struct worker *w = &self->workers[i];
+        w->profiles = calloc(PROFILE_NAMES + 1, sizeof(struct job_profile));
+        if (w->profiles == NULL) {
+            for (size_t j = 0; j < i; ++j) {
+                free(self->workers[j].profiles);
+            }
+            for (size_t j = 0; j < num_workers; ++j) {
+                worker_deques_destroy(&self->workers[j]);
+            }
+            timer_wheel_destroy(&self->timers);
+            mempool_destroy(&self->payloads);
+            mempool_destroy(&self->groups);
+            mempool_destroy(&self->records);
+            pool_queues_destroy(self);
+            free(self);
+            return NULL;
+        }
+    }
+    self->workers[num_workers] = WORKER_MAKER(-1, self);
+
+    atomic_store(&self->workers[0].status, IDLE);
+    atomic_store(&self->num_alive, 1);
+    int ret = thrd_create(&self->workers[0].thr, worker_creator, self);
+    if (ret != 0) {
+        atomic_store(&self->workers[0].status, FAIL);
+        promise_set_value(&self->prms, -1);
+        thrdpool_destroy(self);
+        return NULL;
+    }
+
+    return self;
+}
+
+/**
+ *  Wait until no job is queued or running, or @c until passes.
+ */
+STATIC int pool_wait_idle(struct thread_pool *self, int64_t until)
+{
+    int ret = 0;
+
+    atomic_fetch_add(&self->idle_waiters, 1);
+    while (true) {
+        uint32_t seq = atomic_load(&self->idle_seq);
+        if (atomic_load(&self->num_pending) == 0) {
+            break;
+        }
+        if (until == INT64_MAX) {
+            futex_wait(&self->idle_seq, seq, NULL);
+            continue;
+        }
+
+        int64_t left = until - now_ns();
+        if (left <= 0) {
+            errno = ETIMEDOUT;
+            ret = -1;
+            break;
+        }
+        struct timespec timeout = {
+            .tv_sec = left / 1000000000,
+            .tv_nsec = left % 1000000000,
+        };
+        futex_wait(&self->idle_seq, seq, &timeout);
+    }
+    atomic_fetch_sub(&self->idle_waiters, 1);
+
+    return ret;
+}
+
+/**
+ *  Drop every job that has not started yet.
+ */
+STATIC void pool_discard(struct thread_pool *self)
+{
+    struct job_entry job;
+
+    for (int level = 0; level < THRDPOOL_PRIORITIES; ++level) {
+        while (queue_dequeue(&self->jobs[level], &job) == 0) {
+            job_discard(self, &job, -ECANCELED);
+        }
+        for (size_t i = 0; i < self->num_workers; ++i) {
+            while (deque_shift(&self->workers[i].local_jobs[level], &job) == 0) {
+                job_discard(self, &job, -ECANCELED);
+            }
+        }
+    }
+    size_t num = atomic_load(&self->num_tenants);
+    for (size_t i = 1; i < num; ++i) {
+        while (tenant_dequeue(self->tenants[i], &job) == 0) {
+            job_discard(self, &job, -ECANCELED);
+        }
+    }
+    for (size_t i = 0; self->edf && (i < self->num_workers); ++i) {
+        struct edf_shard *shard = &self->workers[i].edf;
+        while (true) {
+            struct edf_item item;
+            pthread_mutex_lock(&shard->lock);
+            if (shard->num == 0) {
+                pthread_mutex_unlock(&shard->lock);
+                break;
+            }
+            edf_remove_min(shard, &item);
+            edf_publish(shard);
+            pthread_mutex_unlock(&shard->lock);
+            job_discard(self, &item.entry, -ECANCELED);
+        }
+    }
+}
+
+/**
+ *  Wake every worker and join it, they leave instead of parking again.
+ */
+STATIC void worker_stop_all(struct thread_pool *self)
+{
+    atomic_store(&self->stopping, true);
+    for (int i = (int)self->num_workers - 1; i >= 0; --i) {
+        struct worker *w = &self->workers[i];
+        enum worker_state state = atomic_load(&w->status);
+        while (state == RETIRING) {
+            /* Detached and on its way out, wait for the slot to be released. */
+            thrd_yield();
+            state = atomic_load(&w->status);
+        }
+        if ((state != IDLE) || !atomic_compare_exchange_strong(&w->status, &state, STOPPING)) {
+            continue;
+        }
+        /* Wake it as worker_unpark() does, a parked worker re-announces itself. */
+        uint64_t bit = UINT64_C(1) << (i % IDLE_MASK_BITS);
+        if ((atomic_fetch_and(&self->idle_mask[i / IDLE_MASK_BITS], ~bit) & bit) != 0) {
+            atomic_fetch_add(&self->num_spinning, 1);
+        }
+        atomic_store(&w->wakeup, 1);
+        futex_wake(&w->wakeup, 1);
+        thrd_join(w->thr, NULL);
+    }
+}
+
+/**
+ *  @details    Jobs submitted by running jobs are still accepted while
+ *              closing, so nested work such as groups and parallel loops
+ *              completes. Calling it from a worker of the pool would wait
+ *              for the caller itself and fails with EDEADLK.
+ */
+int thrdpool_shutdown(tpool_t tp, int mode, uint64_t deadline)
+{
+    if ((tp == NULL) || (mode == 0) || ((mode & ~(THRDPOOL_DRAIN | THRDPOOL_DISCARD)) != 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    if ((ctx != NULL) && (ctx->pool == self)) {
+        errno = EDEADLK;
+        return -1;
+    }
+
+    int64_t until = INT64_MAX;
+    if (deadline < (uint64_t)(INT64_MAX - now_ns()) / 1000000) {
+        until = now_ns() + ((int64_t)deadline * 1000000);
+    }
+
+    future_get_value(self->ftr, NULL);
+    atomic_store(&self->closing, true);
+    timer_wheel_stop(&self->timers);
+    timer_wheel_discard(&self->timers);
+
+    if ((mode & THRDPOOL_DRAIN) && (pool_wait_idle(self, until) != 0)) {
+        if (!(mode & THRDPOOL_DISCARD)) {
+            /* Still closing and draining, it may be called again. */
+            return -1;
+        }
+    }
+    pool_discard(self);
+    pool_wait_idle(self, INT64_MAX);
+    blocking_monitor_stop(&self->monitor);
+    worker_stop_all(self);
+
+    return 0;
+}
+
+int thrdpool_wait_idle(tpool_t tp)
+{
+    if (tp == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    if ((ctx != NULL) && (ctx->pool == self)) {
+        errno = EDEADLK;
+        return -1;
+    }
+
+    return pool_wait_idle(self, INT64_MAX);
+}
+
+void thrdpool_destroy(tpool_t tp)
+{
+    if (tp == NULL) {
+        return;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    thrdpool_shutdown(self, THRDPOOL_DISCARD, THRDPOOL_FOREVER);
+    for (int i = (int)self->num_workers - 1; i >= 0; --i) {
+        struct worker *w = &self->workers[i];
+        worker_deques_destroy(w);
+        free(w->profiles);
+    }
+    timer_wheel_destroy(&self->timers);
+    mempool_destroy(&self->payloads);
+    mempool_destroy(&self->groups);
+    mempool_destroy(&self->records);
+    for (size_t i = 1; i < atomic_load(&self->num_tenants); ++i) {
+        queue_destroy(&self->tenants[i]->queue);
+        free(self->tenants[i]);
+    }
+    pool_queues_destroy(self);
+    pthread_mutex_destroy(&self->tenants_lock);
+    pthread_mutex_destroy(&self->monitor.lock);
+    pthread_mutex_destroy(&self->tags_lock);
+    free(self);
+}
+
+ssize_t thrdpool_num_workers(tpool_t tp)
+{
+    if (tp == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    return self->num_workers;
+}
+
+int thrdpool_add(tpool_t tp, job_t *job)
+{
+    if ((tp == NULL) || (job == NULL)
+        || ((job->tenant != NULL)
+            && ((job->tenant->pool != tp) || (job->priority != THRDPOOL_PRIO_NORMAL)))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    if (job_pending_add(self, 1) != 0) {
+        return -1;
+    }
+    job->id = atomic_fetch_add(&juid, 1);
+    if (job_record_acquire(self, job) != 0) {
+        job_pending_done(self, 1);
+        return -1;
+    }
+
+    struct job_entry entry;
+    if (job_entry_make(self, &entry, job, self->profiling ? now_ns() : 0) != 0) {
+        if (job->handle.rec != NULL) {
+            job_record_free(job->handle.rec);
+            job->handle = (jhandle_t){0};
+        }
+        job_pending_done(self, 1);
+        return -1;
+    }
+    int level = job->priority;
+    int ret = -1;
+    if (self->edf) {
+        int64_t deadline = job_deadline(self, job);
+        ret = edf_push(self, &entry, &deadline, 1);
+    } else if (job->tenant != NULL) {
+        ret = tenant_enqueue(job->tenant, &entry, 1);
+    } else {
+        pool_use_level(self, level);
+        if ((ctx != NULL) && (ctx->colleagues == self->workers)) {
+            ret = deque_push(&ctx->local_jobs[level], &entry);
+        }
+        if (ret != 0) {
+            ret = queue_enqueue(&self->jobs[level], &entry);
+        }
+    }
+    if (ret != 0) {
+        job_entry_release(self, &entry);
+        if (job->handle.rec != NULL) {
+            job_record_free(job->handle.rec);
+            job->handle = (jhandle_t){0};
+        }
+        job_pending_done(self, 1);
+        return -1;
+    }
+    if (!job->waitable) {
+        job->handle = (jhandle_t){0}; /* A detached record, not the caller's. */
+    }
+
+    /* Publish the job before looking for idlers, pairs with worker_park. */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!worker_wakeup(self)) {
+        worker_grow(self);
+    }
+
+    return 0;
+}
+
+int thrdpool_add_batch(tpool_t tp, job_t *jobs, size_t num)
+{
+    if ((tp == NULL) || (jobs == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (num == 0) {
+        return 0;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    int level = jobs[0].priority;
+    struct thread_pool_tenant *tenant = jobs[0].tenant;
+    for (size_t i = 0; i < num; ++i) {
+        if ((jobs[i].tenant != tenant)
+            || ((tenant != NULL)
+                && ((tenant->pool != self) || (jobs[i].priority != THRDPOOL_PRIO_NORMAL)))
+            || (!self->edf && (tenant == NULL) && (jobs[i].priority != level))) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    if (job_pending_add(self, num) != 0) {
+        return -1;
+    }
+    struct job_entry stack[ENTRY_BATCH];
+    int64_t stack_deadlines[ENTRY_BATCH];
+    struct job_entry *entries = stack;
+    int64_t *deadlines = stack_deadlines;
+    if (num > ENTRY_BATCH) {
+        entries = malloc((sizeof(*entries) + sizeof(*deadlines)) * num);
+        if (entries == NULL) {
+            job_pending_done(self, num);
+            return -1;
+        }
+        deadlines = (int64_t *)&entries[num];
+    }
+
+    juid_t id = atomic_fetch_add(&juid, (juid_t)num);
+    int64_t submit_time = self->profiling ? now_ns() : 0;
+    int ret = 0;
+    size_t acquired = 0; /* Jobs whose handle is ours, the rest still hold the caller's. */
+    size_t made = 0;
+    for (; (acquired < num) && (ret == 0); ++acquired) {
+        job_t *job = &jobs[acquired];
+        job->id = id + (juid_t)acquired;
+        ret = job_record_acquire(self, job);
+        if (ret == 0) {
+            ret = job_entry_make(self, &entries[acquired], job, submit_time);
+        }
+        if (ret == 0) {
+            deadlines[acquired] = job_deadline(self, job);
+            ++made;
+        }
+    }
+
+    if ((ret == 0) && self->edf) {
+        ret = edf_push(self, entries, deadlines, num);
+    } else if ((ret == 0) && (tenant != NULL)) {
+        ret = tenant_enqueue(tenant, entries, num);
+    } else if (ret == 0) {
+        pool_use_level(self, level);
+        ret = -1;
+        if ((ctx != NULL) && (ctx->colleagues == self->workers)) {
+            ret = deque_push_batch(&ctx->local_jobs[level], entries, num);
+        }
+        if (ret != 0) {
+            ret = queue_enqueue_batch(&self->jobs[level], entries, num);
+        }
+    }
+    for (size_t i = 0; (ret != 0) && (i < made); ++i) {
+        job_entry_release(self, &entries[i]);
+    }
+    if (entries != stack) {
+        free(entries);
+    }
+    if (ret != 0) {
+        for (size_t i = 0; i < acquired; ++i) {
+            if (jobs[i].handle.rec != NULL) {
+                job_record_free(jobs[i].handle.rec);
+                jobs[i].handle = (jhandle_t){0};
+            }
+        }
+        job_pending_done(self, num);
+        return -1;
+    }
+    for (size_t i = 0; i < num; ++i) {
+        if (!jobs[i].waitable) {
+            jobs[i].handle = (jhandle_t){0};
+        }
+    }
+
+    /* Publish the jobs before looking for idlers, pairs with worker_park. */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (worker_wakeup_many(self, num) < num) {
+        worker_grow(self);
+    }
+
+    return 0;
+}
+
+/**
+ *  Resolve a handle, failing if it was already waited or released.
+ */
+STATIC struct job_record *job_record_lookup(jhandle_t handle)
+{
+    struct job_record *rec = handle.rec;
+    if ((rec == NULL) || (atomic_load(&rec->gen) != handle.gen)) {
+        errno = ESRCH;
+        return NULL;
+    }
+
+    return rec;
+}
+
+STATIC void job_record_collect(struct job_record *rec, jresult_t *result)
+{
+    intmax_t value;
+    future_get_value(rec->ftr, &value);
+    if (result != NULL) {
+        *result = (jresult_t){
+            .value = (int)value,
+            .start_time = rec->start_time,
+            .end_time = rec->end_time,
+        };
+    }
+    job_record_free(rec);
+}
+
+void thrdpool_blocking_begin(void)
+{
+    struct worker *self = ctx;
+    if ((self == NULL) || (self->blocking++ > 0)) {
+        return;
+    }
+
+    struct thread_pool *pool = self->pool;
+    atomic_store(&self->blocked_since, now_ns());
+    if ((atomic_fetch_add(&pool->num_blocked, 1) == 0) && (pool->monitor.threshold != 0)) {
+        if (!atomic_load(&pool->monitor.started)) {
+            blocking_monitor_start(pool);
+        }
+        blocking_kick(&pool->monitor);
+    }
+}
+
+void thrdpool_blocking_end(void)
+{
+    struct worker *self = ctx;
+    if ((self == NULL) || (self->blocking == 0) || (--self->blocking > 0)) {
+        return;
+    }
+
+    atomic_store(&self->blocked_since, 0);
+    atomic_fetch_sub(&self->pool->num_blocked, 1);
+}
+
+int thrdpool_wait(jhandle_t handle, jresult_t *result)
+{
+    struct job_record *rec = job_record_lookup(handle);
+    if (rec == NULL) {
+        return -1;
+    }
+
+    bool blocking = (atomic_load(&rec->state) == PENDING);
+    if (blocking) {
+        thrdpool_blocking_begin();
+    }
+    job_record_collect(rec, result);
+    if (blocking) {
+        thrdpool_blocking_end();
+    }
+
+    return 0;
+}
+
+int thrdpool_try_wait(jhandle_t handle, jresult_t *result)
+{
+    struct job_record *rec = job_record_lookup(handle);
+    if (rec == NULL) {
+        return -1;
+    }
+
+    if (!future_has_value(rec->ftr)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    job_record_collect(rec, result);
+
+    return 0;
+}
+
+int thrdpool_release(jhandle_t handle)
+{
+    struct job_record *rec = job_record_lookup(handle);
+    if (rec == NULL) {
+        return -1;
+    }
+
+    int state = PENDING;
+    if (!atomic_compare_exchange_strong(&rec->state, &state, DETACHED)) {
+        /* Already done, wait for the promise to be settled before reuse. */
+        job_record_collect(rec, NULL);
+    }
+
+    return 0;
+}
+
+ttenant_t thrdpool_tenant_create(tpool_t tp, uint32_t weight)
+{
+    if ((tp == NULL) || (weight == 0)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    if (self->edf) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    struct thread_pool_tenant *tenant = malloc(sizeof(*tenant));
+    if (tenant == NULL) {
+        return NULL;
+    }
+    if (queue_create(&tenant->queue, sizeof(struct job_entry), self->capacity) != 0) {
+        free(tenant);
+        return NULL;
+    }
+    queue_set_growable(&tenant->queue, self->growable);
+    tenant_init(tenant, self, &tenant->queue, weight);
+
+    pthread_mutex_lock(&self->tenants_lock);
+    size_t num = atomic_load(&self->num_tenants);
+    if (num > THRDPOOL_MAX_TENANTS) {
+        pthread_mutex_unlock(&self->tenants_lock);
+        queue_destroy(&tenant->queue);
+        free(tenant);
+        errno = ENOSPC;
+        return NULL;
+    }
+    tenant->index = num;
+    tenant->bit = UINT64_C(1) << (num - 1);
+    self->tenants[num] = tenant;
+    atomic_store(&self->num_tenants, num + 1);
+    pthread_mutex_unlock(&self->tenants_lock);
+
+    return tenant;
+}
+
+int thrdpool_tenant_set_weight(ttenant_t tenant, uint32_t weight)
+{
+    if ((tenant == NULL) || (weight == 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    atomic_store(&tenant->weight, weight);
+
+    return 0;
+}
+
+int thrdpool_tenant_stats(ttenant_t tenant, ttstats_t *stats)
+{
+    if ((tenant == NULL) || (stats == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    *stats = (ttstats_t){
+        .weight = atomic_load(&tenant->weight),
+        .depth = atomic_load(&tenant->depth),
+        .served = atomic_load_explicit(&tenant->served, memory_order_relaxed),
+        .served_time = atomic_load_explicit(&tenant->served_time, memory_order_relaxed),
+    };
+
+    return 0;
+}
+
+tgroup_t thrdpool_group_create(tpool_t tp)
+{
+    if (tp == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    struct thread_pool_group *grp = mempool_alloc(&self->groups);
+    if (grp == NULL) {
+        return NULL;
+    }
+    grp->pool = self;
+    grp->cancel = NULL;
+    atomic_init(&grp->pending, 0);
+    atomic_init(&grp->done, 0);
+
+    return grp;
+}
+
+int thrdpool_group_destroy(tgroup_t grp)
+{
+    if (grp == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (atomic_load(&grp->pending) != 0) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    cancel_unref(grp->cancel);
+    grp->cancel = NULL;
+    mempool_free(&grp->pool->groups, grp);
+
+    return 0;
+}
+
+int thrdpool_group_set_cancel(tgroup_t grp, tcancel_t cancel)
+{
+    if (grp == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (atomic_load(&grp->pending) != 0) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (cancel != NULL) {
+        cancel_ref(cancel);
+    }
+    cancel_unref(grp->cancel);
+    grp->cancel = cancel;
+
+    return 0;
+}
+
+int thrdpool_group_add(tgroup_t grp, job_t *job)
+{
+    if ((grp == NULL) || (job == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    job->group = grp;
+    atomic_fetch_add(&grp->pending, 1);
+    if (thrdpool_add(grp->pool, job) != 0) {
+        job_group_complete(grp);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ *  @details    A worker of the same pool keeps running its own and stolen
+ *              jobs while it waits, so nested groups cannot starve the pool.
+ *              Other threads simply sleep until the group drains.
+ */
+int thrdpool_group_wait(tgroup_t grp)
+{
+    if (grp == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct worker *self = ((ctx != NULL) && (ctx->pool == grp->pool)) ? ctx : NULL;
+    const struct timespec nap = {.tv_sec = 0, .tv_nsec = 100000};
+
+    while (true) {
+        uint32_t done = atomic_load(&grp->done);
+        if (atomic_load(&grp->pending) == 0) {
+            break;
+        }
+        if (self != NULL) {
+            struct job_entry job;
+            if (job_seeking(self, &job) == 0) {
+                job_run(self, &job);
+                continue;
+            }
+        }
+        futex_wait(&grp->done, done, (self != NULL) ? &nap : NULL);
+    }
+
+    return 0;
+}
+
+STATIC int parallel_range_job(void *arg);
+
+STATIC int parallel_spawn(struct parallel_ctx *pc, size_t begin, size_t end)
+{
+    struct parallel_range r = {
+        .pc = pc,
+        .begin = begin,
+        .end = end,
+    };
+
+    job_t job;
+    thrdpool_job_init(&job, parallel_range_job, NULL);
+    thrdpool_job_set_inline_arg(&job, &r, sizeof(r));
+
+    return thrdpool_group_add(pc->grp, &job);
+}
+
+/**
+ *  Lazy binary splitting: run the range grain by grain, and hand the
+ *  upper half out only when our own deque is empty, i.e. thieves are
+ *  likely hungry.
+ */
+STATIC int parallel_range_job(void *arg)
+{
+    struct parallel_range *r = (struct parallel_range *)arg;
+    struct parallel_ctx *pc = r->pc;
+    size_t begin = r->begin;
+    size_t end = r->end;
+
+    struct worker *self = ((ctx != NULL) && (ctx->pool == pc->grp->pool)) ? ctx : NULL;
+    intmax_t acc = pc->identity;
+    while (begin < end) {
+        if ((self != NULL) && ((end - begin) > pc->grain)
+            && (worker_local_depth(self) == 0)) {
+            size_t mid = begin + ((end - begin) / 2);
+            if (parallel_spawn(pc, mid, end) == 0) {
+                end = mid;
+                continue;
+            }
+        }
+
+        size_t last = ((end - begin) > pc->grain) ? (begin + pc->grain) : end;
+        if (pc->for_body != NULL) {
+            pc->for_body(begin, last, pc->arg);
+        } else {
+            acc = pc->reduce_body(begin, last, acc, pc->arg);
+        }
+        begin = last;
+    }
+
+    if (pc->join != NULL) {
+        intmax_t cur = atomic_load(&pc->result);
+        while (!atomic_compare_exchange_weak(&pc->result, &cur, pc->join(cur, acc, pc->arg))) {
+            /* retry */
+        }
+    }
+
+    return 0;
+}
+
+STATIC int parallel_run(struct thread_pool *self, size_t begin, size_t end, struct parallel_ctx *pc)
+{
+    pc->grp = thrdpool_group_create(self);
+    if (pc->grp == NULL) {
+        return -1;
+    }
+    atomic_init(&pc->result, pc->identity);
+
+    int ret = 0;
+    if ((ctx != NULL) && (ctx->pool == self)) {
+        struct parallel_range r = {
+            .pc = pc,
+            .begin = begin,
+            .end = end,
+        };
+        parallel_range_job(&r);
+    } else {
+        ret = parallel_spawn(pc, begin, end);
+    }
+    thrdpool_group_wait(pc->grp);
+    thrdpool_group_destroy(pc->grp);
+
+    return ret;
+}
+
+int thrdpool_parallel_for(tpool_t tp, size_t begin, size_t end, size_t grain,
+                          void (*body)(size_t, size_t, void *), void *arg)
+{
+    if ((tp == NULL) || (body == NULL) || (begin > end)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (begin == end) {
+        return 0;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    struct parallel_ctx pc = {
+        .grain = (grain > 0) ? grain : 1,
+        .for_body = body,
+        .arg = arg,
+    };
+
+    return parallel_run(self, begin, end, &pc);
+}
+
+int thrdpool_parallel_reduce(tpool_t tp, size_t begin, size_t end, size_t grain,
+                             intmax_t identity,
+                             intmax_t (*body)(size_t, size_t, intmax_t, void *),
+                             intmax_t (*join)(intmax_t, intmax_t, void *),
+                             void *arg, intmax_t *result)
+{
+    if ((tp == NULL) || (body == NULL) || (join == NULL) || (result == NULL) || (begin > end)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (begin == end) {
+        *result = identity;
+        return 0;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    struct parallel_ctx pc = {
+        .grain = (grain > 0) ? grain : 1,
+        .reduce_body = body,
+        .join = join,
+        .identity = identity,
+        .arg = arg,
+    };
+
+    int ret = parallel_run(self, begin, end, &pc);
+    *result = atomic_load(&pc.result);
+
+    return ret;
+}
+
+/**
+ *  Run a graph node, then release every successor whose last
+ *  predecessor this was onto the current worker's deque.
+ */
+STATIC int graph_node_job(void *arg)
+{
+    struct graph_node *node = (struct graph_node *)arg;
+    struct thread_pool_graph *graph = node->graph;
+
+    node->job.func(job_arg(&node->job));
+
+    for (size_t i = 0; i < node->num_succs; ++i) {
+        struct graph_node *succ = &graph->nodes[graph->succs[node->first_succ + i]];
+        if (atomic_fetch_sub(&succ->remaining, 1) == 1) {
+            job_t job;
+            thrdpool_job_init(&job, graph_node_job, succ);
+            job.name = succ->job.name;
+            job.priority = succ->job.priority;
+            if (thrdpool_group_add(graph->grp, &job) != 0) {
+                /* Out of queue space, run it here rather than lose the rest of the run. */
+                graph_node_job(succ);
+            }
+        }
+    }
+
+    return 0;
+}
+
+tgraph_t thrdpool_graph_create(tpool_t tp)
+{
+    if (tp == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    struct thread_pool_graph *graph = calloc(1, sizeof(*graph));
+    if (graph == NULL) {
+        return NULL;
+    }
+    graph->pool = self;
+    graph->grp = thrdpool_group_create(self);
+    if (graph->grp == NULL) {
+        free(graph);
+        return NULL;
+    }
+    atomic_init(&graph->running, false);
+
+    return graph;
+}
+
+int thrdpool_graph_destroy(tgraph_t graph)
+{
+    if (graph == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (atomic_load(&graph->running)) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    for (size_t i = 0; i < graph->num_nodes; ++i) {
+        job_release_arg(&graph->nodes[i].job);
+    }
+    thrdpool_group_destroy(graph->grp);
+    free(graph->roots);
+    free(graph->succs);
+    free(graph->edges);
+    free(graph->nodes);
+    free(graph);
+
+    return 0;
+}
+
+ssize_t thrdpool_graph_add_node(tgraph_t graph, const job_t *job)
+{
+    if ((graph == NULL) || (job == NULL) || (job->func == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (graph->num_nodes == graph->cap_nodes) {
+        size_t cap = (graph->cap_nodes > 0) ? (graph->cap_nodes * 2) : MAX_JOBS;
+        struct graph_node *nodes = realloc(graph->nodes, sizeof(*nodes) * cap);
+        if (nodes == NULL) {
+            return -1;
+        }
+        graph->nodes = nodes;
+        graph->cap_nodes = cap;
+    }
+
+    struct graph_node *node = &graph->nodes[graph->num_nodes];
+    *node = (struct graph_node){
+        .graph = graph,
+        .job = *job,
+    };
+    graph->compiled = false;
+
+    return (ssize_t)graph->num_nodes++;
+}
+
+int thrdpool_graph_add_edge(tgraph_t graph, size_t from, size_t to)
+{
+    if ((graph == NULL) || (from >= graph->num_nodes) || (to >= graph->num_nodes)
+        || (from == to)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (graph->num_edges == graph->cap_edges) {
+        size_t cap = (graph->cap_edges > 0) ? (graph->cap_edges * 2) : MAX_JOBS;
+        struct graph_edge *edges = realloc(graph->edges, sizeof(*edges) * cap);
+        if (edges == NULL) {
+            return -1;
+        }
+        graph->edges = edges;
+        graph->cap_edges = cap;
+    }
+
+    graph->edges[graph->num_edges++] = (struct graph_edge){
+        .from = from,
+        .to = to,
+    };
+    graph->compiled = false;
+
+    return 0;
+}
+
+/**
+ *  @details    Lays the edges out as a CSR successor array and
+ *              rejects cycles with EDEADLK.
+ */
+int thrdpool_graph_compile(tgraph_t graph)
+{
+    if ((graph == NULL) || atomic_load(&graph->running)) {
+        errno = (graph == NULL) ? EINVAL : EBUSY;
+        return -1;
+    }
+
+    size_t *succs = malloc(sizeof(*succs) * (graph->num_edges + 1));
+    size_t *order = malloc(sizeof(*order) * (graph->num_nodes + 1));
+    job_t *roots = malloc(sizeof(*roots) * (graph->num_nodes + 1));
+    if ((succs == NULL) || (order == NULL) || (roots == NULL)) {
+        free(roots);
+        free(order);
+        free(succs);
+        return -1;
+    }
+
+    for (size_t i = 0; i < graph->num_nodes; ++i) {
+        graph->nodes[i].num_preds = 0;
+        graph->nodes[i].num_succs = 0;
+    }
+    for (size_t i = 0; i < graph->num_edges; ++i) {
+        ++graph->nodes[graph->edges[i].from].num_succs;
+        ++graph->nodes[graph->edges[i].to].num_preds;
+    }
+    size_t offset = 0;
+    for (size_t i = 0; i < graph->num_nodes; ++i) {
+        graph->nodes[i].first_succ = offset;
+        offset += graph->nodes[i].num_succs;
+        graph->nodes[i].num_succs = 0;
+    }
+    for (size_t i = 0; i < graph->num_edges; ++i) {
+        struct graph_node *from = &graph->nodes[graph->edges[i].from];
+        succs[from->first_succ + from->num_succs++] = graph->edges[i].to;
+    }
+
+    /* Roots grouped by priority, each level is queued as one batch. */
+    size_t num_roots = 0;
+    for (int level = 0; level < THRDPOOL_PRIORITIES; ++level) {
+        for (size_t i = 0; i < graph->num_nodes; ++i) {
+            struct graph_node *node = &graph->nodes[i];
+            if ((node->num_preds == 0) && (node->job.priority == level)) {
+                thrdpool_job_init(&roots[num_roots], graph_node_job, node);
+                roots[num_roots].name = node->job.name;
+                roots[num_roots].priority = node->job.priority;
+                ++num_roots;
+            }
+        }
+    }
+
+    /* Kahn's algorithm, every node must be reachable from a root. */
+    size_t head = 0;
+    size_t tail = 0;
+    for (size_t i = 0; i < graph->num_nodes; ++i) {
+        struct graph_node *node = &graph->nodes[i];
+        atomic_store_explicit(&node->remaining, node->num_preds, memory_order_relaxed);
+        if (node->num_preds == 0) {
+            order[tail++] = i;
+        }
+    }
+    while (head < tail) {
+        struct graph_node *node = &graph->nodes[order[head++]];
+        for (size_t i = 0; i < node->num_succs; ++i) {
+            struct graph_node *succ = &graph->nodes[succs[node->first_succ + i]];
+            if (atomic_fetch_sub_explicit(&succ->remaining, 1, memory_order_relaxed) == 1) {
+                order[tail++] = succs[node->first_succ + i];
+            }
+        }
+    }
+    free(order);
+    if (tail != graph->num_nodes) {
+        free(roots);
+        free(succs);
+        errno = EDEADLK;
+        return -1;
+    }
+
+    free(graph->roots);
+    free(graph->succs);
+    graph->roots = roots;
+    graph->num_roots = num_roots;
+    graph->succs = succs;
+    graph->compiled = true;
+
+    return 0;
+}
+
+/**
+ *  @details    Blocks until every node has run. Only counters are reset
+ *              between runs, nothing is allocated.
+ */
+int thrdpool_graph_run(tgraph_t graph)
+{
+    if ((graph == NULL) || !graph->compiled) {
+        errno = EINVAL;
+        return -1;
+    }
+    bool idle = false;
+    if (!atomic_compare_exchange_strong(&graph->running, &idle, true)) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (graph->num_nodes == 0) {
+        atomic_store(&graph->running, false);
+        return 0;
+    }
+
+    for (size_t i = 0; i < graph->num_nodes; ++i) {
+        struct graph_node *node = &graph->nodes[i];
+        atomic_store_explicit(&node->remaining, node->num_preds, memory_order_relaxed);
+    }
+    for (size_t i = 0; i < graph->num_roots; ++i) {
+        graph->roots[i].group = graph->grp;
+    }
+
+    int ret = 0;
+    atomic_fetch_add(&graph->grp->pending, graph->num_roots);
+    for (size_t i = 0, num = 0; i < graph->num_roots; i += num) {
+        num = 1;
+        while ((i + num < graph->num_roots)
+               && (graph->roots[i + num].priority == graph->roots[i].priority)) {
+            ++num;
+        }
+        if (thrdpool_add_batch(graph->pool, &graph->roots[i], num) != 0) {
+            /* Levels already queued still run, wait for them below. */
+            atomic_fetch_sub(&graph->grp->pending, graph->num_roots - i);
+            ret = -1;
+            break;
+        }
+    }
+    thrdpool_group_wait(graph->grp);
+    atomic_store(&graph->running, false);
+
+    return ret;
+}
+
+int thrdpool_add_after(tpool_t tp, job_t *job, uint64_t delay)
+{
+    if ((tp == NULL) || (job == NULL) || (job->func == NULL) || (job->tenant != NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    return timer_add(self, job, delay, 0);
+}
+
+int thrdpool_add_every(tpool_t tp, job_t *job, uint64_t period)
+{
+    if ((tp == NULL) || (job == NULL) || (job->func == NULL) || (period == 0)
+        || job->waitable || (job->cancel != NULL) || (job->tag != 0) || (job->tenant != NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    return timer_add(self, job, period, period);
+}
+
+int thrdpool_cancel_tag(tpool_t tp, uint32_t tag)
+{
+    if ((tp == NULL) || (tag == 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    /* Unlinked, so jobs added from now on get a fresh token. */
+    pthread_mutex_lock(&self->tags_lock);
+    struct thread_pool_cancel **link = &self->tags[tag % CANCEL_TAG_BUCKETS];
+    while (*link != NULL) {
+        struct thread_pool_cancel *cancel = *link;
+        if (cancel->tag == tag) {
+            atomic_store_explicit(&cancel->requested, true, memory_order_release);
+            *link = cancel->next;
+        } else {
+            link = &cancel->next;
+        }
+    }
+    pthread_mutex_unlock(&self->tags_lock);
+
+    return 0;
+}
+
+int thrdpool_timer_cancel(thandle_t timer)
+{
+    struct thread_pool_timer *tmr = timer.tmr;
+    if (tmr == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct timer_wheel *wheel = tmr->wheel;
+    pthread_mutex_lock(&wheel->lock);
+    if (atomic_load(&tmr->gen) != timer.gen) {
+        pthread_mutex_unlock(&wheel->lock);
+        errno = ESRCH;
+        return -1;
+    }
+    job_t job = tmr->job;
+    timer_unlink(tmr);
+    timer_free(wheel, tmr);
+    pthread_mutex_unlock(&wheel->lock);
+
+    job_release_arg(&job);
+    if (job.handle.rec != NULL) {
+        job_record_complete(job.handle.rec, -ECANCELED, 0, 0);
+    }
+
+    return 0;
+}
+
+STATIC void histo_merge(jhisto_t *dst, const struct job_histo *src)
+{
+    uint64_t max = atomic_load_explicit(&src->max, memory_order_relaxed);
+
+    dst->count += atomic_load_explicit(&src->count, memory_order_relaxed);
+    dst->total += atomic_load_explicit(&src->total, memory_order_relaxed);
+    dst->max = (max > dst->max) ? max : dst->max;
+    for (size_t i = 0; i < THRDPOOL_HISTO_BUCKETS; ++i) {
+        dst->buckets[i] += atomic_load_explicit(&src->buckets[i], memory_order_relaxed);
+    }
+}
+
+/**
+ *  @details    Merges the per-worker shards by name without stopping
+ *              the workers, so counts of jobs in flight may be skewed.
+ */
+ssize_t thrdpool_job_stats(tpool_t tp, jstats_t *stats, size_t num)
+{
+    if ((tp == NULL) || ((stats == NULL) && (num > 0))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    if (!self->profiling) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    size_t found = 0;
+    for (size_t i = 0; i < self->num_workers; ++i) {
+        struct job_profile *profiles = self->workers[i].profiles;
+        for (size_t j = 0; j <= PROFILE_NAMES; ++j) {
+            struct job_profile *prof = &profiles[j];
+            if (!atomic_load_explicit(&prof->used, memory_order_acquire)) {
+                continue;
+            }
+
+            const char *name = job_name_lookup(prof->name);
+            size_t k = 0;
+            while ((k < found) && (strncmp(stats[k].name, name, JOB_NAME_MAX) != 0)) {
+                ++k;
+            }
+            if (k == found) {
+                if (found == num) {
+                    continue;
+                }
+                memset(&stats[k], 0, sizeof(stats[k]));
+                strncpy(stats[k].name, name, sizeof(stats[k].name) - 1);
+                ++found;
+            }
+            histo_merge(&stats[k].wait, &prof->wait);
+            histo_merge(&stats[k].run, &prof->run);
+        }
+    }
+
+    return (ssize_t)found;
+}
+
+int64_t thrdpool_histo_percentile(const jhisto_t *histo, double percentile)
+{
+    if ((histo == NULL) || (percentile < 0.0) || (percentile > 100.0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (histo->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)((percentile / 100.0) * (double)histo->count);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < THRDPOOL_HISTO_BUCKETS; ++i) {
+        seen += histo->buckets[i];
+        if (seen >= rank) {
+            int64_t upper = (i + 1 < THRDPOOL_HISTO_BUCKETS)
+                            ? (histo_bucket_lower(i + 1) - 1) : (int64_t)histo->max;
+            return (upper < (int64_t)histo->max) ? upper : (int64_t)histo->max;
+        }
+    }
+
+    return (int64_t)histo->max;
+}
+
+/**
+ *  @details    Counters are read while the workers keep running,
+ *              so they are individually exact but not mutually consistent.
+ */
+int thrdpool_stats(tpool_t tp, tstats_t *stats)
+{
+    if ((tp == NULL) || (stats == NULL)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    SELFLIZE(struct thread_pool *, tp);
+
+    stats->num_workers = self->num_workers;
+    stats->num_alive = atomic_load(&self->num_alive);
+    stats->num_active = atomic_load(&self->num_active);
+    stats->num_idle = atomic_load(&self->num_idle);
+    stats->global_depth = pool_global_depth(self);
+    stats->num_blocked = atomic_load(&self->num_blocked);
+    stats->compensations = atomic_load_explicit(&self->monitor.compensations, memory_order_relaxed);
+    for (size_t i = 0; i < self->num_workers; ++i) {
+        struct worker *w = &self->workers[i];
+        twstats_t *ws = &stats->workers[i];
+
+        ws->executed = atomic_load_explicit(&w->counters.executed, memory_order_relaxed);
+        ws->stolen = atomic_load_explicit(&w->counters.stolen, memory_order_relaxed);
+        ws->steal_failures = atomic_load_explicit(&w->counters.steal_failures, memory_order_relaxed);
+        ws->parks = atomic_load_explicit(&w->counters.parks, memory_order_relaxed);
+        ws->unparks = atomic_load_explicit(&w->counters.unparks, memory_order_relaxed);
+        ws->idle_time = atomic_load_explicit(&w->counters.idle_time, memory_order_relaxed);
+        ws->expired = atomic_load_explicit(&w->counters.expired, memory_order_relaxed);
+        ws->cancelled = atomic_load_explicit(&w->counters.cancelled, memory_order_relaxed);
+        ws->local_depth = worker_local_depth(w);
+        ws->blocked = (atomic_load(&w->blocked_since) != 0);
+        job_view_read(&w->view, ws);
+        if (stats->steals != NULL) {
+            for (size_t j = 0; j < self->num_workers; ++j) {
+                stats->steals[(i * self->num_workers) + j] =
+                    atomic_load_explicit(&w->counters.stolen_from[j], memory_order_relaxed);
+            }
+        }
+    }
+
+    return 0;
 }
@@ -11,6 +11,7 @@
 #define _GNU_SOURCE
 #endif
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <stdatomic.h>
 #include <stdint.h>
@@ -21,6 +22,8 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
+#include <sys/resource.h>
+#include <dirent.h>
 
 #include <semaphore.h>
 
@@ -75,11 +78,6 @@ static list_t tcbs;
  */
 static mpool_t suspends;
 
-/**
- *  buckets desc.
- */
-static mpool_t buckets;
-
 #if 0
 static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
 #endif
@@ -93,7 +91,6 @@ static void tcb_initialize(void)
 {
     list_create(&tcbs, sizeof(struct thread_control_block), MAX_THREADS);
     mempool_create(&suspends, sizeof(sem_t), MAX_THREADS);
-    mempool_create(&buckets, sizeof(struct thread_control_block), 10);
 }
 
 /**
@@ -102,7 +99,6 @@ static void tcb_initialize(void)
 __attribute__((destructor))
 static void tcb_finalizer(void)
 {
-    mempool_destroy(&buckets);
     mempool_destroy(&suspends);
     list_destroy(&tcbs);
 }
@@ -139,10 +135,22 @@ INLINE void internal_task_finalizer(void *arg)
     UNUSED_VARIABLE(arg);
 
     struct thread_control_block tcb;
-    list_delete(&tcbs, thrd_current(), &tcb);
+    if (list_delete(&tcbs, thrd_current(), &tcb) == 0) {
+        mempool_free(&suspends, tcb.suspend);
+    }
+}
 
-    mempool_free(&suspends, tcb.suspend);
-    pthread_key_delete(tcb_key);
+/**
+ *  tcb_key_once desc.
+ */
+static pthread_once_t tcb_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ *  internal_tcb_key_create desc.
+ */
+INLINE void internal_tcb_key_create(void)
+{
+    pthread_key_create(&tcb_key, internal_task_finalizer);
 }
 
 /**
@@ -159,26 +167,22 @@ INLINE void *internal_entry(void *arg)
     tcb->suspend = mempool_alloc(&suspends);
     if (tcb->suspend == NULL) {
         ERROR("threads: Can't allocate TCB");
-        mempool_free(&buckets, tcb);
         promise_set_value(tcb->prms, -ENOMEM);
         return NULL;
     }
     if (sem_init(tcb->suspend, 0, 0) != 0) {
         ERROR("threads: Can't initialize TCB");
-        mempool_free(&buckets, tcb);
         promise_set_value(tcb->prms, -ENOMEM);
         return NULL;
     }
     int ret = list_insert(&tcbs, tcb->thr, tcb);
     if (ret != 0) {
         ERROR("threads: Can't allocate TCB");
-        mempool_free(&buckets, tcb);
         promise_set_value(tcb->prms, -ENOMEM);
         return NULL;
     }
-    pthread_key_create(&tcb_key, internal_task_finalizer);
+    pthread_once(&tcb_key_once, internal_tcb_key_create);
     pthread_setspecific(tcb_key, (void *)(intptr_t)tcb->tid);
-    mempool_free(&buckets, tcb);
 
     struct sigaction act;
     memset(&act, 0, sizeof(act));
@@ -188,9 +192,12 @@ INLINE void *internal_entry(void *arg)
     sigaction(SIGURG, &act, NULL);
     suspend = tcb->suspend;
 
+    /* The TCB lives on the creator's stack until the promise is set. */
+    thrd_start_t func = tcb->func;
+    void *func_arg = tcb->arg;
     promise_set_value(tcb->prms, 0);
-    tcb->prms = NULL;
-    return (void *)(intptr_t)tcb->func(tcb->arg);
+
+    return (void *)(intptr_t)func(func_arg);
 }
 
 /**
@@ -211,13 +218,9 @@ int thrd_create(thrd_t *thr, thrd_start_t func, void *arg)
     promise_t prms = PROMISE_INITIALIZER;
     future_t *ftr = promise_get_future(&prms);
 
-    struct thread_control_block *tcb = mempool_alloc(&buckets);
-    if (tcb == NULL) {
-        return -1;
-    }
-    *tcb = TCB_MAKER(func, arg, &prms);
+    struct thread_control_block tcb = TCB_MAKER(func, arg, &prms);
 
-    int err = pthread_create(thr, NULL, internal_entry, tcb);
+    int err = pthread_create(thr, NULL, internal_entry, &tcb);
     if (err != 0) {
         errno = err;
         return -1;
@@ -479,34 +482,274 @@ int thrd_get_name(thrd_t thr, char *name, size_t len)
     return 0;
 }
 
+/**
+ *  internal_thread_tid desc.
+ *
+ *  @param  [in]    thr thr desc.
+ *  @return Returns task id of @c thr if succeed, -1 if failed.
+ */
+INLINE pid_t internal_thread_tid(thrd_t thr)
+{
+    if (pthread_equal(thr, thrd_current())) {
+        return gettid();
+    }
+
+    struct thread_control_block tcb;
+    if (list_search(&tcbs, thr, &tcb) != 0) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    return tcb.tid;
+}
 
+/**
+ *  @details    thrd_set_prior desc.
+ *
+ *  @param      [in]    thr     thr desc.
+ *  @param      [in]    prior   Nice value, -20 (highest) to 19 (lowest).
+ *  @return     Returns zero if succeed, -1 if failed.
+ */
 int thrd_set_prior(thrd_t thr, int prior)
 {
-    UNUSED_VARIABLE(thr);
-    UNUSED_VARIABLE(prior);
-    errno = ENOTSUP;
-    return -1;
+    pid_t tid = internal_thread_tid(thr);
+    if (tid < 0) {
+        return -1;
+    }
+
+    return setpriority(PRIO_PROCESS, tid, prior);
 }
 
+/**
+ *  @details    thrd_get_prior desc.
+ *
+ *  As getpriority(2), -1 is a valid nice value,
+ *  so clear errno beforehand to tell failures apart.
+ *
+ *  @param      [in]    thr thr desc.
+ *  @return     Returns nice value if succeed, -1 if failed.
+ */
 int thrd_get_prior(thrd_t thr)
 {
-    UNUSED_VARIABLE(thr);
-    errno = ENOTSUP;
-    return -1;
+    pid_t tid = internal_thread_tid(thr);
+    if (tid < 0) {
+        return -1;
+    }
+
+    return getpriority(PRIO_PROCESS, tid);
 }
 
+/**
+ *  @details    thrd_set_affinity desc.
+ *
+ *  @param      [in]    thr     thr desc.
+ *  @param      [in]    cpuset  cpuset desc.
+ *  @return     Returns zero if succeed, -1 if failed.
+ */
 int thrd_set_affinity(thrd_t thr, const cpu_set_t *cpuset)
 {
-    UNUSED_VARIABLE(thr);
-    UNUSED_VARIABLE(cpuset);
-    errno = ENOTSUP;
-    return -1;
+    if (cpuset == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int err = pthread_setaffinity_np(thr, sizeof(*cpuset), cpuset);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
 }
 
+/**
+ *  @details    thrd_get_affinity desc.
+ *
+ *  @param      [in]    thr     thr desc.
+ *  @param      [out]   cpuset  cpuset desc.
+ *  @return     Returns zero if succeed, -1 if failed.
+ */
 int thrd_get_affinity(thrd_t thr, cpu_set_t *cpuset)
 {
-    UNUSED_VARIABLE(thr);
-    UNUSED_VARIABLE(cpuset);
-    errno = ENOTSUP;
-    return -1;
+    if (cpuset == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int err = pthread_getaffinity_np(thr, sizeof(*cpuset), cpuset);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ *  internal_read_int desc.
+ *
+ *  @param  [in]    path    path desc.
+ *  @param  [in]    def     Value returned if @c path can't be read.
+ *  @return Returns the integer in @c path.
+ */
+INLINE int internal_read_int(const char *path, int def)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return def;
+    }
+
+    int val;
+    if (fscanf(fp, "%d", &val) != 1) {
+        val = def;
+    }
+    fclose(fp);
+
+    return val;
+}
+
+/**
+ *  internal_cpu_llc desc.
+ *
+ *  @param  [in]    cpu cpu desc.
+ *  @return Returns the lowest CPU sharing the last-level cache with @c cpu,
+ *          -1 if unknown.
+ */
+INLINE int internal_cpu_llc(int cpu)
+{
+    char path[128];
+    int level = 0;
+    int first = -1;
+
+    for (int i = 0; ; ++i) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, i);
+        int lv = internal_read_int(path, -1);
+        if (lv < 0) {
+            break;
+        }
+        if (lv < level) {
+            continue;
+        }
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", cpu, i);
+        int shared = internal_read_int(path, -1);
+        if (shared >= 0) {
+            level = lv;
+            first = shared;
+        }
+    }
+
+    return first;
+}
+
+/**
+ *  internal_cpu_node desc.
+ *
+ *  @param  [in]    cpu cpu desc.
+ *  @return Returns NUMA node of @c cpu, 0 if unknown.
+ */
+INLINE int internal_cpu_node(int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return 0;
+    }
+
+    int node = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (sscanf(ent->d_name, "node%d", &node) == 1) {
+            break;
+        }
+    }
+    closedir(dir);
+
+    return node;
+}
+
+/**
+ *  internal_dense_id desc.
+ *
+ *  @param  [in,out]    keys    Keys seen so far.
+ *  @param  [in,out]    num     Number of @c keys.
+ *  @param  [in]        key     key desc.
+ *  @return Returns index of @c key in @c keys, appending it if new.
+ */
+INLINE int internal_dense_id(long *keys, size_t *num, long key)
+{
+    for (size_t i = 0; i < *num; ++i) {
+        if (keys[i] == key) {
+            return (int)i;
+        }
+    }
+    keys[*num] = key;
+
+    return (int)(*num)++;
+}
+
+/**
+ *  @details    thrd_get_topology desc.
+ *
+ *  Only CPUs the calling process may run on are reported.
+ *  Missing sysfs entries fall back to one core per CPU,
+ *  one package, one cache group and one node.
+ *
+ *  @param      [out]   topo    topo desc.
+ *  @return     Returns zero if succeed, -1 if failed.
+ */
+int thrd_get_topology(cpu_topo_t *topo)
+{
+    if (topo == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return -1;
+    }
+
+    long *keys = malloc(sizeof(*keys) * MAX_CPUS * 4);
+    if (keys == NULL) {
+        return -1;
+    }
+    long *packages = &keys[0];
+    long *cores = &keys[MAX_CPUS];
+    long *llcs = &keys[MAX_CPUS * 2];
+    long *nodes = &keys[MAX_CPUS * 3];
+
+    memset(topo, 0, sizeof(*topo));
+    for (int cpu = 0; cpu < (int)MAX_CPUS; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) {
+            continue;
+        }
+
+        char path[128];
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        int package = internal_read_int(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        int core = internal_read_int(path, cpu);
+        int llc = internal_cpu_llc(cpu);
+
+        struct cpu_info *info = &topo->cpus[topo->num_cpus++];
+        info->cpu = cpu;
+        info->package = internal_dense_id(packages, &topo->num_packages, package);
+        info->core = internal_dense_id(cores, &topo->num_cores, ((long)package << 32) | core);
+        info->llc = internal_dense_id(llcs, &topo->num_llcs,
+                                      (llc >= 0) ? llc : (-1L - package));
+        info->node = internal_dense_id(nodes, &topo->num_nodes, internal_cpu_node(cpu));
+        info->smt = 0;
+        for (size_t i = 0; i + 1 < topo->num_cpus; ++i) {
+            if (topo->cpus[i].core == info->core) {
+                ++info->smt;
+            }
+        }
+    }
+    free(keys);
+
+    return 0;
 }
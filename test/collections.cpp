@@ -7,6 +7,8 @@
  *
  *  This code is licensed under the MIT License.
  */
+#include <cerrno>
+#include <atomic>
 #include <catch2/catch.hpp>
 
 using Catch::Matchers::Equals;
@@ -109,6 +111,58 @@ SCENARIO("メモリプールからメモリを取得できること", tags("coll
     }
 }
 
+SCENARIO("メモリプールが拡張できること", tags("collections", "mempool", "mempool_set_growable")) {
+
+    GIVEN("拡張可能なメモリプールを作成する") {
+        mpool_t mp;
+        size_t capacity{4};
+
+        INFO("容量: " + std::to_string(capacity));
+
+        REQUIRE(mempool_create(&mp, sizeof(int), capacity) == 0);
+        REQUIRE(mempool_set_growable(&mp, true) == 0);
+
+        WHEN("容量を超えてメモリを取得する") {
+            int *vals[10];
+            for (auto &v : vals) {
+                v = (int *)mempool_alloc(&mp);
+            }
+
+            THEN("取得できること") {
+                for (auto &v : vals) {
+                    CHECK(v != NULL);
+                    CHECK(mempool_contains(&mp, v));
+                }
+                CHECK(mempool_capacity(&mp) >= (ssize_t)lengthof(vals));
+            }
+        }
+
+        mempool_destroy(&mp);
+    }
+
+    GIVEN("拡張不可能なメモリプールを作成する") {
+        mpool_t mp;
+        size_t capacity{4};
+
+        INFO("容量: " + std::to_string(capacity));
+
+        REQUIRE(mempool_create(&mp, sizeof(int), capacity) == 0);
+
+        WHEN("容量を超えてメモリを取得する") {
+            for (size_t i = 0; i < capacity; ++i) {
+                CHECK(mempool_alloc(&mp) != NULL);
+            }
+
+            THEN("取得できないこと") {
+                CHECK(mempool_alloc(&mp) == NULL);
+                CHECK(errno == ENOMEM);
+            }
+        }
+
+        mempool_destroy(&mp);
+    }
+}
+
 SCENARIO("キューを作成できること", tags("collections", "queue", "queue_create", "queue_destroy")) {
 
     GIVEN("特になし") {
@@ -233,6 +287,343 @@ SCENARIO("キューからデータを取得できること", tags("collections",
 
 }
 
+SCENARIO("キューにデータをまとめて追加できること", tags("collections", "queue", "queue_enqueue_batch")) {
+
+    GIVEN("キューにデータを追加しておく") {
+        que_t q;
+        size_t capacity{20};
+        int first{0};
+        int data[]{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+
+        INFO("容量: " + std::to_string(capacity));
+        INFO("データ: [1, 2, 3, 4, 5, 6, 7, 8, 9, 10]");
+
+        REQUIRE(queue_create(&q, sizeof(data[0]), capacity) == 0);
+        CHECK(queue_enqueue(&q, &first) == 0);
+
+        WHEN("キューにデータをまとめて追加する") {
+            CHECK(queue_enqueue_batch(&q, data, lengthof(data)) == 0);
+
+            THEN("追加した順に取得できること") {
+                int result{-1};
+                CHECK(queue_size(&q) == (ssize_t)lengthof(data) + 1);
+                CHECK(queue_dequeue(&q, &result) == 0);
+                CHECK(result == first);
+                for (auto &d : data) {
+                    CHECK(queue_dequeue(&q, &result) == 0);
+                    CHECK(result == d);
+                }
+                CHECK(queue_dequeue(&q, &result) == -1);
+                CHECK(queue_size(&q) == 0);
+            }
+        }
+
+        WHEN("容量を超えてデータをまとめて追加する") {
+            CHECK(queue_enqueue_batch(&q, data, lengthof(data)) == 0);
+
+            THEN("追加できないこと") {
+                CHECK(queue_enqueue_batch(&q, data, lengthof(data)) == -1);
+                CHECK(errno == ENOMEM);
+            }
+        }
+
+        queue_destroy(&q);
+    }
+}
+
+SCENARIO("キューが拡張できること", tags("collections", "queue", "queue_set_growable")) {
+
+    GIVEN("拡張可能なキューを作成する") {
+        que_t q;
+        size_t capacity{2};
+        int data[]{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+
+        INFO("容量: " + std::to_string(capacity));
+
+        REQUIRE(queue_create(&q, sizeof(data[0]), capacity) == 0);
+        REQUIRE(queue_set_growable(&q, true) == 0);
+
+        WHEN("容量を超えてデータを追加する") {
+            for (auto &d : data) {
+                CHECK(queue_enqueue(&q, &d) == 0);
+            }
+
+            THEN("追加した順に取得できること") {
+                int result{-1};
+                CHECK(queue_size(&q) == (ssize_t)lengthof(data));
+                for (auto &d : data) {
+                    CHECK(queue_dequeue(&q, &result) == 0);
+                    CHECK(result == d);
+                }
+                CHECK(queue_size(&q) == 0);
+            }
+        }
+
+        queue_destroy(&q);
+    }
+}
+
+SCENARIO("両端キューを作成できること", tags("collections", "deque", "deque_create", "deque_destroy")) {
+
+    GIVEN("特になし") {
+
+        WHEN("両端キューを作成する") {
+            deq_t q;
+            size_t capacity{1};
+
+            INFO("容量: " + std::to_string(capacity));
+
+            THEN("両端キューが作成できること") {
+                REQUIRE(deque_create(&q, sizeof(int), capacity) == 0);
+                deque_destroy(&q);
+            }
+        }
+
+        WHEN("両端キューを作成する") {
+            deq_t q;
+            size_t capacity{10000};
+
+            INFO("容量: " + std::to_string(capacity));
+
+            THEN("両端キューが作成できること") {
+                REQUIRE(deque_create(&q, sizeof(int), capacity) == 0);
+                deque_destroy(&q);
+            }
+        }
+    }
+}
+
+SCENARIO("両端キューの末尾からデータを取得できること", tags("collections", "deque", "deque_push", "deque_pop")) {
+
+    GIVEN("両端キューにデータを追加しておく") {
+        deq_t q;
+        size_t capacity{10};
+        int data[]{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+
+        INFO("容量: " + std::to_string(capacity));
+        INFO("データ: [1, 2, 3, 4, 5, 6, 7, 8, 9, 10]");
+
+        REQUIRE(deque_create(&q, sizeof(data[0]), capacity) == 0);
+        for (auto &d : data) {
+            CHECK(deque_push(&q, &d) == 0);
+        }
+        CHECK(deque_size(&q) == lengthof(data));
+
+        WHEN("両端キューの末尾からデータを取得する") {
+
+            THEN("追加した逆順に取得できること") {
+                int result{-1};
+                for (int i = lengthof(data) - 1; i >= 0; --i) {
+                    CHECK(deque_pop(&q, &result) == 0);
+                    CHECK(result == data[i]);
+                }
+                CHECK(deque_pop(&q, &result) == -1);
+                CHECK(errno == ENOENT);
+            }
+        }
+
+        deque_destroy(&q);
+    }
+}
+
+SCENARIO("両端キューの先頭からデータを取得できること", tags("collections", "deque", "deque_push", "deque_shift")) {
+
+    GIVEN("両端キューにデータを追加しておく") {
+        deq_t q;
+        size_t capacity{10};
+        int data[]{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+
+        INFO("容量: " + std::to_string(capacity));
+        INFO("データ: [1, 2, 3, 4, 5, 6, 7, 8, 9, 10]");
+
+        REQUIRE(deque_create(&q, sizeof(data[0]), capacity) == 0);
+        for (auto &d : data) {
+            CHECK(deque_push(&q, &d) == 0);
+        }
+
+        WHEN("両端キューの先頭からデータを取得する") {
+
+            THEN("追加した順に取得できること") {
+                int result{-1};
+                for (size_t i = 0; i < lengthof(data); ++i) {
+                    CHECK(deque_shift(&q, &result) == 0);
+                    CHECK(result == data[i]);
+                }
+                CHECK(deque_shift(&q, &result) == -1);
+                CHECK(errno == ENOENT);
+            }
+        }
+
+        WHEN("他のスレッドから先頭のデータを取得する") {
+            std::atomic<int> stolen{0};
+            auto thief = [&](void *) -> int {
+                int result;
+                while (true) {
+                    if (deque_shift(&q, &result) == 0) {
+                        stolen += 1;
+                    } else if (errno != EAGAIN) {
+                        break;
+                    }
+                }
+                return 0;
+            };
+
+            thrd_t thr;
+            REQUIRE(thrd_create(&thr, Lambda::ptr<int, void *>(thief), NULL) == 0);
+            int popped{0};
+            int result;
+            while (deque_pop(&q, &result) == 0) {
+                popped += 1;
+            }
+            thrd_join(thr, NULL);
+
+            THEN("全てのデータが一度だけ取得されること") {
+                CHECK(deque_size(&q) == 0);
+                CHECK(stolen + popped == (int)lengthof(data));
+            }
+        }
+
+        deque_destroy(&q);
+    }
+}
+
+SCENARIO("両端キューにデータをまとめて追加できること", tags("collections", "deque", "deque_push_batch")) {
+
+    GIVEN("両端キューを作成しておく") {
+        deq_t q;
+        size_t capacity{10};
+        int data[]{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+
+        INFO("容量: " + std::to_string(capacity));
+        INFO("データ: [1, 2, 3, 4, 5, 6, 7, 8, 9, 10]");
+
+        REQUIRE(deque_create(&q, sizeof(data[0]), capacity) == 0);
+
+        WHEN("両端キューにデータをまとめて追加する") {
+            CHECK(deque_push_batch(&q, data, lengthof(data)) == 0);
+
+            THEN("末尾からは逆順, 先頭からは順に取得できること") {
+                int result{-1};
+                CHECK(deque_pop(&q, &result) == 0);
+                CHECK(result == data[lengthof(data) - 1]);
+                CHECK(deque_shift(&q, &result) == 0);
+                CHECK(result == data[0]);
+                CHECK(deque_size(&q) == lengthof(data) - 2);
+            }
+        }
+
+        deque_destroy(&q);
+    }
+}
+
+SCENARIO("両端キューの先頭からデータをまとめて取得できること", tags("collections", "deque", "deque_shift_batch")) {
+
+    GIVEN("データを追加した両端キューを作成しておく") {
+        deq_t q;
+        size_t capacity{10};
+        int data[]{1, 2, 3, 4, 5, 6, 7};
+
+        INFO("容量: " + std::to_string(capacity));
+        INFO("データ: [1, 2, 3, 4, 5, 6, 7]");
+
+        REQUIRE(deque_create(&q, sizeof(data[0]), capacity) == 0);
+        REQUIRE(deque_push_batch(&q, data, lengthof(data)) == 0);
+
+        WHEN("先頭からまとめて取得する") {
+            int result[8]{};
+            ssize_t num = deque_shift_batch(&q, result, lengthof(result));
+
+            THEN("半分 (切り上げ) が先頭から順に取得できること") {
+                REQUIRE(num == 4);
+                for (ssize_t i = 0; i < num; ++i) {
+                    CHECK(result[i] == data[i]);
+                }
+                CHECK(deque_size(&q) == 3);
+            }
+        }
+
+        WHEN("上限を指定して取得する") {
+            int result[2]{};
+            ssize_t num = deque_shift_batch(&q, result, lengthof(result));
+
+            THEN("上限までしか取得しないこと") {
+                REQUIRE(num == 2);
+                CHECK(result[0] == data[0]);
+                CHECK(result[1] == data[1]);
+                CHECK(deque_size(&q) == 5);
+            }
+        }
+
+        WHEN("空になるまで取得する") {
+            int result[8]{};
+            while (deque_shift_batch(&q, result, lengthof(result)) > 0) {
+            }
+
+            THEN("最後は取得に失敗すること") {
+                CHECK(deque_size(&q) == 0);
+                CHECK(deque_shift_batch(&q, result, lengthof(result)) == -1);
+                CHECK(errno == ENOENT);
+            }
+        }
+
+        deque_destroy(&q);
+    }
+}
+
+SCENARIO("両端キューが拡張できること", tags("collections", "deque", "deque_set_growable")) {
+
+    GIVEN("拡張可能な両端キューを作成する") {
+        deq_t q;
+        size_t capacity{2};
+        int data[]{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+
+        INFO("容量: " + std::to_string(capacity));
+
+        REQUIRE(deque_create(&q, sizeof(data[0]), capacity) == 0);
+        REQUIRE(deque_set_growable(&q, true) == 0);
+
+        WHEN("先頭からデータを取得しながら容量を超えて追加する") {
+            int result{-1};
+            CHECK(deque_push(&q, &data[0]) == 0);
+            CHECK(deque_push(&q, &data[1]) == 0);
+            CHECK(deque_shift(&q, &result) == 0);
+            CHECK(result == data[0]);
+            for (size_t i = 2; i < lengthof(data); ++i) {
+                CHECK(deque_push(&q, &data[i]) == 0);
+            }
+
+            THEN("順序が保たれること") {
+                for (size_t i = 1; i < lengthof(data); ++i) {
+                    CHECK(deque_shift(&q, &result) == 0);
+                    CHECK(result == data[i]);
+                }
+            }
+        }
+
+        deque_destroy(&q);
+    }
+
+    GIVEN("拡張不可能な両端キューを作成する") {
+        deq_t q;
+        size_t capacity{2};
+        int data{10};
+
+        REQUIRE(deque_create(&q, sizeof(data), capacity) == 0);
+
+        WHEN("容量を超えてデータを追加する") {
+            CHECK(deque_push(&q, &data) == 0);
+            CHECK(deque_push(&q, &data) == 0);
+
+            THEN("追加できないこと") {
+                CHECK(deque_push(&q, &data) == -1);
+                CHECK(errno == ENOMEM);
+            }
+        }
+
+        deque_destroy(&q);
+    }
+}
+
 SCENARIO("リストを作成できること", tags("collections", "list", "list_create", "list_destroy")) {
 
     GIVEN("特になし") {
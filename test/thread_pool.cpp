@@ -8,6 +8,12 @@
  *  This code is licensed under the MIT License.
  */
 #include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
 #include <catch2/catch.hpp>
 
 using Catch::Matchers::Equals;
@@ -22,6 +28,100 @@ extern "C" {
 #include "debug.h"
 }
 
+struct fib_arg {
+    tpool_t tp;
+    int n;
+    long result;
+};
+
+static int fib_job(void *arg)
+{
+    struct fib_arg *self = (struct fib_arg *)arg;
+
+    if (self->n < 2) {
+        self->result = self->n;
+        return 0;
+    }
+
+    struct fib_arg sub[2] = {
+        {self->tp, self->n - 1, 0},
+        {self->tp, self->n - 2, 0},
+    };
+    tgroup_t grp = thrdpool_group_create(self->tp);
+    for (auto &s : sub) {
+        job_t job;
+        thrdpool_job_init(&job, fib_job, &s);
+        thrdpool_group_add(grp, &job);
+    }
+    thrdpool_group_wait(grp);
+    thrdpool_group_destroy(grp);
+    self->result = sub[0].result + sub[1].result;
+
+    return 0;
+}
+
+static void mark_range(size_t begin, size_t end, void *arg)
+{
+    std::atomic<int> *marks = (std::atomic<int> *)arg;
+
+    for (size_t i = begin; i < end; ++i) {
+        marks[i].fetch_add(1);
+    }
+}
+
+static intmax_t sum_range(size_t begin, size_t end, intmax_t acc, void *arg)
+{
+    (void)arg;
+
+    for (size_t i = begin; i < end; ++i) {
+        acc += (intmax_t)i;
+    }
+    return acc;
+}
+
+static intmax_t sum_join(intmax_t lhs, intmax_t rhs, void *arg)
+{
+    (void)arg;
+
+    return lhs + rhs;
+}
+
+static int nested_reduce_job(void *arg)
+{
+    struct fib_arg *self = (struct fib_arg *)arg;
+    intmax_t sum = 0;
+
+    thrdpool_parallel_reduce(self->tp, 0, self->n, 16, 0, sum_range, sum_join, NULL, &sum);
+    self->result = sum;
+
+    return 0;
+}
+
+struct graph_arg {
+    std::atomic<int> *clock;
+    int stamp;
+    int runs;
+};
+
+static int stamp_job(void *arg)
+{
+    struct graph_arg *self = (struct graph_arg *)arg;
+
+    self->stamp = self->clock->fetch_add(1);
+    ++self->runs;
+
+    return 0;
+}
+
+static int count_job(void *arg)
+{
+    std::atomic<int> *count = (std::atomic<int> *)arg;
+
+    count->fetch_add(1);
+
+    return 0;
+}
+
 SCENARIO("スレッドプールが作成できること", tags("thread_pool", "thrdpool_create")) {
 
     GIVEN("特になし") {
@@ -43,6 +143,102 @@ SCENARIO("スレッドプールが作成できること", tags("thread_pool", "t
     }
 }
 
+SCENARIO("キューの容量を指定してスレッドプールが作成できること", tags("thread_pool", "thrdpool_create_attr")) {
+
+    GIVEN("容量を指定しておく") {
+        size_t capacity = 4;
+        tpool_attr_t attr;
+
+        REQUIRE(thrdpool_attr_init(&attr, 1) == 0);
+        REQUIRE(thrdpool_attr_set_capacity(&attr, capacity) == 0);
+
+        INFO("容量: " + std::to_string(capacity));
+
+        WHEN("ワーカーが塞がった状態でジョブを追加する") {
+            tpool_t tp = thrdpool_create_attr(&attr);
+            REQUIRE(tp != NULL);
+
+            promise_t started = PROMISE_INITIALIZER;
+            future_t *started_ftr = promise_get_future(&started);
+            promise_t release = PROMISE_INITIALIZER;
+            future_t *release_ftr = promise_get_future(&release);
+            auto blocker = [&](void *) -> int {
+                promise_set_value(&started, 0);
+                future_get_value(release_ftr, NULL);
+                return 0;
+            };
+            auto nop = [&](void *) -> int {
+                return 0;
+            };
+
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(blocker), NULL);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            future_get_value(started_ftr, NULL);
+
+            THEN("容量までは追加でき, それ以上は追加できないこと") {
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(nop), NULL);
+                for (size_t i = 0; i < capacity; ++i) {
+                    CHECK(thrdpool_add(tp, &job) == 0);
+                }
+                CHECK(thrdpool_add(tp, &job) == -1);
+                CHECK(errno == ENOMEM);
+            }
+
+            promise_set_value(&release, 0);
+            thrdpool_destroy(tp);
+        }
+    }
+
+    GIVEN("容量を無制限にしておく") {
+        tpool_attr_t attr;
+
+        REQUIRE(thrdpool_attr_init(&attr, 1) == 0);
+        REQUIRE(thrdpool_attr_set_capacity(&attr, THRDPOOL_UNBOUNDED) == 0);
+
+        WHEN("ワーカーが塞がった状態でジョブを追加する") {
+            size_t num_jobs = 10000;
+            tpool_t tp = thrdpool_create_attr(&attr);
+            REQUIRE(tp != NULL);
+
+            promise_t release = PROMISE_INITIALIZER;
+            future_t *release_ftr = promise_get_future(&release);
+            std::atomic<size_t> done{0};
+            auto blocker = [&](void *) -> int {
+                future_get_value(release_ftr, NULL);
+                return 0;
+            };
+            auto runner = [&](void *) -> int {
+                done += 1;
+                return 0;
+            };
+
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(blocker), NULL);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+
+            INFO("ジョブ数: " + std::to_string(num_jobs));
+
+            THEN("全て追加でき, 実行されること") {
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(runner), NULL);
+                for (size_t i = 0; i < num_jobs; ++i) {
+                    REQUIRE(thrdpool_add(tp, &job) == 0);
+                }
+                promise_set_value(&release, 0);
+
+                int64_t base = getuptime(0);
+                while ((done < num_jobs) && (getuptime(base) < 5000)) {
+                    msleep(1);
+                }
+                CHECK(done == num_jobs);
+            }
+
+            promise_set_value(&release, 0);
+            thrdpool_destroy(tp);
+        }
+    }
+}
+
 SCENARIO("ジョブが実行できること", tags("thread_pool", "thrdpool_job_init")) {
 
     GIVEN("特になし") {
@@ -117,6 +313,1609 @@ SCENARIO("ジョブが実行できること", tags("thread_pool", "thrdpool_job_
             }
         }
 
+        WHEN("ジョブを連続して追加する") {
+            size_t num_jobs = 1000;
+            std::atomic<size_t> done{0};
+
+            INFO("ジョブ数: " + std::to_string(num_jobs));
+
+            auto runner = [&](void *) -> int {
+                done += 1;
+                return 0;
+            };
+
+            for (size_t i = 0; i < num_jobs; ++i) {
+                job_t job;
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(runner), NULL);
+                while (thrdpool_add(tp, &job) != 0) {
+                    thrd_yield();
+                }
+            }
+
+            THEN("全てのジョブが実行されること") {
+                int64_t base = getuptime(0);
+                while ((done < num_jobs) && (getuptime(base) < 5000)) {
+                    msleep(1);
+                }
+                CHECK(done == num_jobs);
+            }
+        }
+
+        WHEN("ジョブをまとめて追加する") {
+            size_t num_jobs = 1000;
+            std::atomic<size_t> done{0};
+
+            INFO("ジョブ数: " + std::to_string(num_jobs));
+
+            auto runner = [&](void *) -> int {
+                done += 1;
+                return 0;
+            };
+
+            std::vector<job_t> jobs(num_jobs);
+            for (auto &job : jobs) {
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(runner), NULL);
+            }
+            CHECK(thrdpool_add_batch(tp, jobs.data(), jobs.size()) == 0);
+
+            THEN("全てのジョブが連番で実行されること") {
+                for (size_t i = 1; i < jobs.size(); ++i) {
+                    CHECK(jobs[i].id == jobs[0].id + i);
+                }
+                int64_t base = getuptime(0);
+                while ((done < num_jobs) && (getuptime(base) < 5000)) {
+                    msleep(1);
+                }
+                CHECK(done == num_jobs);
+            }
+        }
+
+        WHEN("ジョブからジョブをまとめて追加する") {
+            size_t num_jobs = 100;
+            std::atomic<size_t> done{0};
+
+            INFO("ジョブ数: " + std::to_string(num_jobs));
+
+            auto runner = [&](void *) -> int {
+                done += 1;
+                return 0;
+            };
+            auto spawner = [&](void *) -> int {
+                std::vector<job_t> jobs(num_jobs);
+                for (auto &job : jobs) {
+                    thrdpool_job_init(&job, Lambda::ptr<int, void *>(runner), NULL);
+                }
+                return thrdpool_add_batch(tp, jobs.data(), jobs.size());
+            };
+
+            job_t job;
+            CHECK(thrdpool_job_init(&job, Lambda::ptr<int, void *>(spawner), NULL) == 0);
+            CHECK(thrdpool_add(tp, &job) == 0);
+
+            THEN("全てのジョブが実行されること") {
+                int64_t base = getuptime(0);
+                while ((done < num_jobs) && (getuptime(base) < 5000)) {
+                    msleep(1);
+                }
+                CHECK(done == num_jobs);
+            }
+        }
+
+        WHEN("待機可能なジョブを追加する") {
+            int our_val = 999;
+
+            auto runner = [&](void *arg) -> int {
+                msleep(10);
+                return (int)(intptr_t)arg;
+            };
+
+            job_t job;
+            CHECK(thrdpool_job_init(&job, Lambda::ptr<int, void *>(runner), (void *)(intptr_t)our_val) == 0);
+            CHECK(thrdpool_job_set_waitable(&job, true) == 0);
+            CHECK(thrdpool_add(tp, &job) == 0);
+
+            THEN("ジョブの戻り値と実行時間が取得できること") {
+                jresult_t result;
+                REQUIRE(thrdpool_wait(job.handle, &result) == 0);
+                CHECK(result.value == our_val);
+                CHECK(result.start_time > 0);
+                CHECK(result.end_time - result.start_time >= 10 * 1000000);
+            }
+
+            THEN("待機済みのハンドルは使用できないこと") {
+                REQUIRE(thrdpool_wait(job.handle, NULL) == 0);
+                CHECK(thrdpool_wait(job.handle, NULL) == -1);
+                CHECK(errno == ESRCH);
+                CHECK(thrdpool_release(job.handle) == -1);
+            }
+
+            THEN("完了するまでポーリングできること") {
+                jresult_t result;
+                while (thrdpool_try_wait(job.handle, &result) != 0) {
+                    REQUIRE(errno == EAGAIN);
+                    msleep(1);
+                }
+                CHECK(result.value == our_val);
+            }
+
+            THEN("待機せずに解放できること") {
+                CHECK(thrdpool_release(job.handle) == 0);
+            }
+        }
+
+        WHEN("待機可能なジョブをまとめて追加する") {
+            size_t num_jobs = 100;
+
+            INFO("ジョブ数: " + std::to_string(num_jobs));
+
+            auto runner = [&](void *arg) -> int {
+                return (int)(intptr_t)arg;
+            };
+
+            std::vector<job_t> jobs(num_jobs);
+            for (size_t i = 0; i < num_jobs; ++i) {
+                thrdpool_job_init(&jobs[i], Lambda::ptr<int, void *>(runner), (void *)(intptr_t)i);
+                thrdpool_job_set_waitable(&jobs[i], true);
+            }
+            CHECK(thrdpool_add_batch(tp, jobs.data(), jobs.size()) == 0);
+
+            THEN("全てのジョブの戻り値が取得できること") {
+                for (size_t i = 0; i < num_jobs; ++i) {
+                    jresult_t result;
+                    REQUIRE(thrdpool_wait(jobs[i].handle, &result) == 0);
+                    CHECK(result.value == (int)i);
+                }
+            }
+        }
+
+        WHEN("グループにジョブを追加する") {
+            size_t num_jobs = 100;
+            std::atomic<size_t> done{0};
+
+            INFO("ジョブ数: " + std::to_string(num_jobs));
+
+            auto runner = [&](void *) -> int {
+                msleep(1);
+                done += 1;
+                return 0;
+            };
+
+            tgroup_t grp = thrdpool_group_create(tp);
+            REQUIRE(grp != NULL);
+            for (size_t i = 0; i < num_jobs; ++i) {
+                job_t job;
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(runner), NULL);
+                CHECK(thrdpool_group_add(grp, &job) == 0);
+            }
+
+            THEN("グループの完了を待機できること") {
+                CHECK(thrdpool_group_wait(grp) == 0);
+                CHECK(done == num_jobs);
+                CHECK(thrdpool_group_destroy(grp) == 0);
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+
+    GIVEN("ワーカー数の少ないスレッドプールを作成しておく") {
+        size_t num_workers = 2;
+        tpool_t tp;
+
+        tp = thrdpool_create(num_workers);
+        REQUIRE(tp != NULL);
+
+        WHEN("ジョブの中でグループを入れ子に待機する") {
+            struct fib_arg arg = {tp, 16, 0};
+
+            INFO("フィボナッチ数: " + std::to_string(arg.n));
+
+            job_t job;
+            thrdpool_job_init(&job, fib_job, &arg);
+            thrdpool_job_set_waitable(&job, true);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+
+            THEN("デッドロックせずに完了すること") {
+                CHECK(thrdpool_wait(job.handle, NULL) == 0);
+                CHECK(arg.result == 987);
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+}
+
+SCENARIO("範囲を並列に処理できること", tags("thread_pool", "thrdpool_parallel_for")) {
+
+    GIVEN("スレッドプールを作成しておく") {
+        size_t num_workers = 4;
+        tpool_t tp;
+
+        tp = thrdpool_create(num_workers);
+        REQUIRE(tp != NULL);
+
+        WHEN("範囲の各要素を並列に処理する") {
+            const size_t num = 100000;
+            std::vector<std::atomic<int>> marks(num);
+            for (auto &m : marks) {
+                m = 0;
+            }
+
+            REQUIRE(thrdpool_parallel_for(tp, 0, num, 64, mark_range, marks.data()) == 0);
+
+            THEN("全ての要素が一度だけ処理されること") {
+                size_t once = 0;
+                for (auto &m : marks) {
+                    once += (m.load() == 1) ? 1 : 0;
+                }
+                CHECK(once == num);
+            }
+        }
+
+        WHEN("範囲の総和を並列に求める") {
+            const size_t num = 100000;
+            intmax_t sum = -1;
+
+            REQUIRE(thrdpool_parallel_reduce(tp, 0, num, 64, 0, sum_range, sum_join, NULL, &sum) == 0);
+
+            THEN("逐次計算と同じ結果になること") {
+                CHECK(sum == (intmax_t)(num * (num - 1) / 2));
+            }
+        }
+
+        WHEN("空の範囲を処理する") {
+            intmax_t sum = -1;
+
+            REQUIRE(thrdpool_parallel_reduce(tp, 10, 10, 1, 0, sum_range, sum_join, NULL, &sum) == 0);
+
+            THEN("単位元が返ること") {
+                CHECK(sum == 0);
+            }
+        }
+
+        WHEN("ジョブの中から並列処理を呼び出す") {
+            struct fib_arg arg = {tp, 10000, 0};
+
+            job_t job;
+            thrdpool_job_init(&job, nested_reduce_job, &arg);
+            thrdpool_job_set_waitable(&job, true);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+
+            THEN("デッドロックせずに完了すること") {
+                CHECK(thrdpool_wait(job.handle, NULL) == 0);
+                CHECK(arg.result == 10000L * 9999 / 2);
+            }
+        }
+
+        WHEN("不正な範囲を指定する") {
+            THEN("エラーになること") {
+                CHECK(thrdpool_parallel_for(tp, 10, 0, 1, mark_range, NULL) == -1);
+                CHECK(errno == EINVAL);
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+}
+
+SCENARIO("依存関係のあるジョブをグラフとして実行できること", tags("thread_pool", "thrdpool_graph_run")) {
+
+    GIVEN("スレッドプールを作成しておく") {
+        size_t num_workers = 4;
+        tpool_t tp;
+
+        tp = thrdpool_create(num_workers);
+        REQUIRE(tp != NULL);
+
+        WHEN("菱形のグラフを繰り返し実行する") {
+            std::atomic<int> clock(0);
+            std::vector<struct graph_arg> args(4, {&clock, -1, 0});
+            tgraph_t graph = thrdpool_graph_create(tp);
+            REQUIRE(graph != NULL);
+
+            for (auto &a : args) {
+                job_t job;
+                thrdpool_job_init(&job, stamp_job, &a);
+                REQUIRE(thrdpool_graph_add_node(graph, &job) >= 0);
+            }
+            REQUIRE(thrdpool_graph_add_edge(graph, 0, 1) == 0);
+            REQUIRE(thrdpool_graph_add_edge(graph, 0, 2) == 0);
+            REQUIRE(thrdpool_graph_add_edge(graph, 1, 3) == 0);
+            REQUIRE(thrdpool_graph_add_edge(graph, 2, 3) == 0);
+            REQUIRE(thrdpool_graph_compile(graph) == 0);
+
+            THEN("依存関係の順序で全てのノードが実行されること") {
+                const int num_runs = 100;
+                for (int i = 0; i < num_runs; ++i) {
+                    REQUIRE(thrdpool_graph_run(graph) == 0);
+                    CHECK(args[0].stamp < args[1].stamp);
+                    CHECK(args[0].stamp < args[2].stamp);
+                    CHECK(args[1].stamp < args[3].stamp);
+                    CHECK(args[2].stamp < args[3].stamp);
+                }
+                for (auto &a : args) {
+                    CHECK(a.runs == num_runs);
+                }
+                CHECK(thrdpool_graph_destroy(graph) == 0);
+            }
+        }
+
+        WHEN("幅の広いグラフを実行する") {
+            const size_t width = 200;
+            std::atomic<int> clock(0);
+            std::vector<struct graph_arg> args(width + 2, {&clock, -1, 0});
+            tgraph_t graph = thrdpool_graph_create(tp);
+            REQUIRE(graph != NULL);
+
+            for (auto &a : args) {
+                job_t job;
+                thrdpool_job_init(&job, stamp_job, &a);
+                REQUIRE(thrdpool_graph_add_node(graph, &job) >= 0);
+            }
+            for (size_t i = 1; i <= width; ++i) {
+                REQUIRE(thrdpool_graph_add_edge(graph, 0, i) == 0);
+                REQUIRE(thrdpool_graph_add_edge(graph, i, width + 1) == 0);
+            }
+            REQUIRE(thrdpool_graph_compile(graph) == 0);
+            REQUIRE(thrdpool_graph_run(graph) == 0);
+
+            THEN("終端のノードが最後に実行されること") {
+                CHECK(args[width + 1].stamp == (int)(width + 1));
+                CHECK(thrdpool_graph_destroy(graph) == 0);
+            }
+        }
+
+        WHEN("循環するグラフをコンパイルする") {
+            std::atomic<int> clock(0);
+            struct graph_arg arg = {&clock, -1, 0};
+            tgraph_t graph = thrdpool_graph_create(tp);
+            REQUIRE(graph != NULL);
+
+            job_t job;
+            thrdpool_job_init(&job, stamp_job, &arg);
+            for (int i = 0; i < 3; ++i) {
+                REQUIRE(thrdpool_graph_add_node(graph, &job) >= 0);
+            }
+            REQUIRE(thrdpool_graph_add_edge(graph, 0, 1) == 0);
+            REQUIRE(thrdpool_graph_add_edge(graph, 1, 2) == 0);
+            REQUIRE(thrdpool_graph_add_edge(graph, 2, 1) == 0);
+
+            THEN("エラーになり実行できないこと") {
+                CHECK(thrdpool_graph_compile(graph) == -1);
+                CHECK(errno == EDEADLK);
+                CHECK(thrdpool_graph_run(graph) == -1);
+                CHECK(errno == EINVAL);
+                CHECK(thrdpool_graph_destroy(graph) == 0);
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+}
+
+SCENARIO("ジョブを遅延実行と周期実行できること", tags("thread_pool", "thrdpool_add_after", "thrdpool_add_every")) {
+
+    GIVEN("スレッドプールを作成しておく") {
+        size_t num_workers = 4;
+        tpool_t tp;
+
+        tp = thrdpool_create(num_workers);
+        REQUIRE(tp != NULL);
+
+        WHEN("待機可能なジョブを遅延実行する") {
+            std::atomic<int> count(0);
+            job_t job;
+            thrdpool_job_init(&job, count_job, &count);
+            thrdpool_job_set_waitable(&job, true);
+
+            int64_t base = getuptime(0);
+            REQUIRE(thrdpool_add_after(tp, &job, 150) == 0);
+
+            THEN("遅延時間の経過後に実行されること") {
+                CHECK(thrdpool_wait(job.handle, NULL) == 0);
+                CHECK(getuptime(base) >= 150);
+                CHECK(count == 1);
+                CHECK(thrdpool_timer_cancel(job.timer) == -1);
+                CHECK(errno == ESRCH);
+            }
+        }
+
+        WHEN("多数のジョブを異なる遅延で実行する") {
+            const int num_jobs = 10000;
+            std::atomic<int> count(0);
+            for (int i = 0; i < num_jobs; ++i) {
+                job_t job;
+                thrdpool_job_init(&job, count_job, &count);
+                REQUIRE(thrdpool_add_after(tp, &job, i % 200) == 0);
+            }
+
+            THEN("全てのジョブが実行されること") {
+                int64_t base = getuptime(0);
+                while ((count < num_jobs) && (getuptime(base) < 5000)) {
+                    msleep(1);
+                }
+                CHECK(count == num_jobs);
+            }
+        }
+
+        WHEN("遅延実行をキャンセルする") {
+            std::atomic<int> count(0);
+            job_t job;
+            thrdpool_job_init(&job, count_job, &count);
+            REQUIRE(thrdpool_add_after(tp, &job, 100) == 0);
+            REQUIRE(thrdpool_timer_cancel(job.timer) == 0);
+
+            THEN("ジョブが実行されないこと") {
+                msleep(200);
+                CHECK(count == 0);
+                CHECK(thrdpool_timer_cancel(job.timer) == -1);
+                CHECK(errno == ESRCH);
+            }
+        }
+
+        WHEN("待機可能なジョブの遅延実行をキャンセルする") {
+            std::atomic<int> count(0);
+            job_t job;
+            thrdpool_job_init(&job, count_job, &count);
+            thrdpool_job_set_waitable(&job, true);
+            REQUIRE(thrdpool_add_after(tp, &job, 100) == 0);
+            REQUIRE(thrdpool_timer_cancel(job.timer) == 0);
+
+            THEN("キャンセルされたことが待機側に通知されること") {
+                jresult_t result;
+                CHECK(thrdpool_wait(job.handle, &result) == 0);
+                CHECK(result.value == -ECANCELED);
+                CHECK(count == 0);
+            }
+        }
+
+        WHEN("ジョブを周期実行する") {
+            std::atomic<int> count(0);
+            job_t job;
+            thrdpool_job_init(&job, count_job, &count);
+            REQUIRE(thrdpool_add_every(tp, &job, 10) == 0);
+
+            THEN("キャンセルするまで繰り返し実行されること") {
+                int64_t base = getuptime(0);
+                while ((count < 5) && (getuptime(base) < 5000)) {
+                    msleep(1);
+                }
+                CHECK(count >= 5);
+                CHECK(thrdpool_timer_cancel(job.timer) == 0);
+                msleep(30);
+                int stopped = count;
+                msleep(50);
+                CHECK(count == stopped);
+            }
+        }
+
+        WHEN("待機可能なジョブを周期実行する") {
+            job_t job;
+            thrdpool_job_init(&job, count_job, NULL);
+            thrdpool_job_set_waitable(&job, true);
+
+            THEN("エラーになること") {
+                CHECK(thrdpool_add_every(tp, &job, 10) == -1);
+                CHECK(errno == EINVAL);
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+}
+
+SCENARIO("ジョブ名が共有されること", tags("thread_pool", "thrdpool_job_set_name")) {
+
+    GIVEN("ジョブを2つ初期化しておく") {
+        job_t a, b;
+        REQUIRE(thrdpool_job_init(&a, count_job, NULL) == 0);
+        REQUIRE(thrdpool_job_init(&b, count_job, NULL) == 0);
+
+        WHEN("同じ名前を設定する") {
+            REQUIRE(thrdpool_job_set_name(&a, "interned") == 0);
+            REQUIRE(thrdpool_job_set_name(&b, "interned") == 0);
+
+            THEN("同じ名前として参照できること") {
+                CHECK(a.name != 0);
+                CHECK(a.name == b.name);
+                CHECK_THAT(thrdpool_job_get_name(&a), Equals("interned"));
+            }
+        }
+
+        WHEN("名前を設定しない") {
+            THEN("空の名前になること") {
+                CHECK(a.name == 0);
+                CHECK_THAT(thrdpool_job_get_name(&a), Equals(""));
+            }
+        }
+
+        WHEN("長すぎる名前を設定する") {
+            std::string name(JOB_NAME_MAX * 2, 'x');
+            REQUIRE(thrdpool_job_set_name(&a, name.c_str()) == 0);
+
+            THEN("切り詰めた名前になること") {
+                CHECK(thrdpool_job_get_name(&a) == name.substr(0, JOB_NAME_MAX - 1));
+            }
+        }
+    }
+}
+
+SCENARIO("実行中のジョブ名が参照できること", tags("thread_pool", "thrdpool_current_job_name")) {
+
+    struct probe {
+        const char *label;
+        char thread_name[16];
+    };
+    auto probe_job = [](void *arg) -> int {
+        struct probe *p = (struct probe *)arg;
+        p->label = thrdpool_current_job_name();
+        thrd_get_name(thrd_current(), p->thread_name, sizeof(p->thread_name));
+        return 0;
+    };
+
+    GIVEN("既定の属性でスレッドプールを作成しておく") {
+        tpool_attr_t attr;
+        REQUIRE(thrdpool_attr_init(&attr, 1) == 0);
+
+        WHEN("名前付きのジョブを実行する") {
+            tpool_t tp = thrdpool_create_attr(&attr);
+            REQUIRE(tp != NULL);
+
+            struct probe p = {};
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(probe_job), &p);
+            thrdpool_job_set_name(&job, "labeled");
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+            thrdpool_destroy(tp);
+
+            THEN("ジョブ名が参照でき、スレッド名は変わらないこと") {
+                REQUIRE(p.label != NULL);
+                CHECK_THAT(p.label, Equals("labeled"));
+                CHECK_THAT(p.thread_name, !Equals("labeled"));
+                CHECK(thrdpool_current_job_name() == NULL);
+            }
+        }
+
+        WHEN("スレッド名の変更を有効にして名前付きのジョブを実行する") {
+            REQUIRE(thrdpool_attr_set_thread_names(&attr, true) == 0);
+            tpool_t tp = thrdpool_create_attr(&attr);
+            REQUIRE(tp != NULL);
+
+            struct probe p = {};
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(probe_job), &p);
+            thrdpool_job_set_name(&job, "labeled");
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+            thrdpool_destroy(tp);
+
+            THEN("スレッド名もジョブ名になること") {
+                CHECK_THAT(p.thread_name, Equals("labeled"));
+            }
+        }
+    }
+}
+
+SCENARIO("ジョブ名ごとの実行時間が集計できること", tags("thread_pool", "thrdpool_job_stats")) {
+
+    GIVEN("プロファイルを有効にしたスレッドプールを作成しておく") {
+        tpool_attr_t attr;
+        REQUIRE(thrdpool_attr_init(&attr, 4) == 0);
+        REQUIRE(thrdpool_attr_set_profiling(&attr, true) == 0);
+
+        tpool_t tp = thrdpool_create_attr(&attr);
+        REQUIRE(tp != NULL);
+
+        WHEN("名前の異なるジョブを実行する") {
+            const int num_jobs = 50;
+            auto slow = [](void *arg) -> int {
+                (void)arg;
+                msleep(2);
+                return 0;
+            };
+            std::atomic<int> count(0);
+            tgroup_t grp = thrdpool_group_create(tp);
+            REQUIRE(grp != NULL);
+            for (int i = 0; i < num_jobs; ++i) {
+                job_t job;
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(slow), NULL);
+                thrdpool_job_set_name(&job, "slow");
+                REQUIRE(thrdpool_group_add(grp, &job) == 0);
+                thrdpool_job_init(&job, count_job, &count);
+                thrdpool_job_set_name(&job, "fast");
+                REQUIRE(thrdpool_group_add(grp, &job) == 0);
+            }
+            REQUIRE(thrdpool_group_wait(grp) == 0);
+            REQUIRE(thrdpool_group_destroy(grp) == 0);
+
+            THEN("名前ごとの件数と実行時間が取得できること") {
+                std::vector<jstats_t> stats(8);
+                ssize_t num = thrdpool_job_stats(tp, stats.data(), stats.size());
+                REQUIRE(num == 2);
+
+                const jstats_t *s = nullptr;
+                const jstats_t *f = nullptr;
+                for (ssize_t i = 0; i < num; ++i) {
+                    if (std::string(stats[i].name) == "slow") {
+                        s = &stats[i];
+                    } else if (std::string(stats[i].name) == "fast") {
+                        f = &stats[i];
+                    }
+                }
+                REQUIRE(s != nullptr);
+                REQUIRE(f != nullptr);
+                CHECK(s->run.count == (uint64_t)num_jobs);
+                CHECK(s->wait.count == (uint64_t)num_jobs);
+                CHECK(f->run.count == (uint64_t)num_jobs);
+                CHECK(thrdpool_histo_percentile(&s->run, 50.0) >= 2000000);
+                CHECK(thrdpool_histo_percentile(&f->run, 50.0) < thrdpool_histo_percentile(&s->run, 50.0));
+                CHECK(thrdpool_histo_percentile(&s->run, 100.0) == (int64_t)s->run.max);
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+
+    GIVEN("プロファイルを無効にしたスレッドプールを作成しておく") {
+        tpool_t tp = thrdpool_create(2);
+        REQUIRE(tp != NULL);
+
+        WHEN("集計を取得する") {
+            jstats_t stats;
+
+            THEN("エラーになること") {
+                CHECK(thrdpool_job_stats(tp, &stats, 1) == -1);
+                CHECK(errno == ENOTSUP);
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+}
+
+SCENARIO("スレッドプールの統計情報が取得できること", tags("thread_pool", "thrdpool_stats")) {
+
+    GIVEN("スレッドプールを作成しておく") {
+        size_t num_workers = 4;
+        tpool_t tp;
+
+        tp = thrdpool_create(num_workers);
+        REQUIRE(tp != NULL);
+
+        WHEN("実行中のジョブがある") {
+            static std::atomic<bool> release;
+            release = false;
+            auto probe = [](void *arg) -> int {
+                (void)arg;
+                while (!release) {
+                    msleep(1);
+                }
+                return 0;
+            };
+
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(probe), NULL);
+            thrdpool_job_set_name(&job, "probe");
+            thrdpool_job_set_waitable(&job, true);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            msleep(50);
+
+            THEN("実行中のジョブが参照できること") {
+                std::unique_ptr<tstats_t> stats(new tstats_t());
+                REQUIRE(thrdpool_stats(tp, stats.get()) == 0);
+                CHECK(stats->num_workers == num_workers);
+
+                size_t running = 0;
+                for (size_t i = 0; i < stats->num_workers; ++i) {
+                    if (stats->workers[i].running) {
+                        ++running;
+                        CHECK(stats->workers[i].job_id == job.id);
+                        CHECK_THAT(stats->workers[i].job_name, Equals("probe"));
+                    }
+                }
+                CHECK(running == 1);
+
+                release = true;
+                CHECK(thrdpool_wait(job.handle, NULL) == 0);
+            }
+        }
+
+        WHEN("ジョブを実行し終える") {
+            const int num_jobs = 1000;
+            std::atomic<int> count(0);
+            tgroup_t grp = thrdpool_group_create(tp);
+            REQUIRE(grp != NULL);
+            for (int i = 0; i < num_jobs; ++i) {
+                job_t job;
+                thrdpool_job_init(&job, count_job, &count);
+                REQUIRE(thrdpool_group_add(grp, &job) == 0);
+            }
+            REQUIRE(thrdpool_group_wait(grp) == 0);
+            REQUIRE(thrdpool_group_destroy(grp) == 0);
+            msleep(10);
+
+            THEN("実行数と盗んだ数が集計されること") {
+                std::unique_ptr<tstats_t> stats(new tstats_t());
+                std::vector<uint64_t> steals(num_workers * num_workers);
+                stats->steals = steals.data();
+                REQUIRE(thrdpool_stats(tp, stats.get()) == 0);
+
+                uint64_t executed = 0;
+                for (size_t i = 0; i < num_workers; ++i) {
+                    uint64_t from = 0;
+                    for (size_t j = 0; j < num_workers; ++j) {
+                        from += steals[(i * num_workers) + j];
+                    }
+                    CHECK(from == stats->workers[i].stolen);
+                    CHECK(steals[(i * num_workers) + i] == 0);
+                    CHECK_FALSE(stats->workers[i].running);
+                    executed += stats->workers[i].executed;
+                }
+                CHECK(executed == (uint64_t)num_jobs);
+                CHECK(stats->global_depth == 0);
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+}
+
+SCENARIO("ワーカーを CPU に配置できること", tags("thread_pool", "thrdpool_attr_set_placement")) {
+
+    GIVEN("使用可能な CPU を調べておく") {
+        cpu_set_t allowed;
+        REQUIRE(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+
+        static cpu_set_t seen;
+        auto probe = [](void *arg) -> int {
+            (void)arg;
+            return thrd_get_affinity(thrd_current(), &seen);
+        };
+
+        WHEN("ワーカーを詰めて、または分散して配置する") {
+            enum thrdpool_placement placement = GENERATE(THRDPOOL_PLACE_COMPACT, THRDPOOL_PLACE_SCATTER);
+            tpool_attr_t attr;
+            REQUIRE(thrdpool_attr_init(&attr, 2) == 0);
+            REQUIRE(thrdpool_attr_set_placement(&attr, placement, NULL) == 0);
+            tpool_t tp = thrdpool_create_attr(&attr);
+            REQUIRE(tp != NULL);
+
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(probe), NULL);
+            thrdpool_job_set_waitable(&job, true);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+
+            THEN("ワーカーが 1 つの CPU に固定されること") {
+                jresult_t result;
+                CHECK(thrdpool_wait(job.handle, &result) == 0);
+                CHECK(result.value == 0);
+                CHECK(CPU_COUNT(&seen) == 1);
+            }
+
+            thrdpool_destroy(tp);
+        }
+
+        WHEN("CPU の集合を指定して配置する") {
+            tpool_attr_t attr;
+            REQUIRE(thrdpool_attr_init(&attr, 2) == 0);
+            REQUIRE(thrdpool_attr_set_placement(&attr, THRDPOOL_PLACE_CPUSET, &allowed) == 0);
+            tpool_t tp = thrdpool_create_attr(&attr);
+            REQUIRE(tp != NULL);
+
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(probe), NULL);
+            thrdpool_job_set_waitable(&job, true);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+
+            THEN("ワーカーが集合に制限されること") {
+                CHECK(thrdpool_wait(job.handle, NULL) == 0);
+                CHECK(CPU_EQUAL(&seen, &allowed));
+            }
+
+            thrdpool_destroy(tp);
+        }
+
+        WHEN("空の集合を指定する") {
+            tpool_attr_t attr;
+            cpu_set_t empty;
+            CPU_ZERO(&empty);
+            REQUIRE(thrdpool_attr_init(&attr, 2) == 0);
+
+            THEN("エラーになること") {
+                CHECK(thrdpool_attr_set_placement(&attr, THRDPOOL_PLACE_CPUSET, &empty) == -1);
+                CHECK(errno == EINVAL);
+            }
+        }
+    }
+}
+
+SCENARIO("負荷に応じてワーカー数が増減すること", tags("thread_pool", "thrdpool_attr_set_elastic")) {
+
+    GIVEN("伸縮するスレッドプールを作成しておく") {
+        size_t min_workers = 1;
+        size_t max_workers = 4;
+        tpool_attr_t attr;
+        REQUIRE(thrdpool_attr_init(&attr, min_workers) == 0);
+        REQUIRE(thrdpool_attr_set_elastic(&attr, max_workers, 1, 50) == 0);
+
+        tpool_t tp = thrdpool_create_attr(&attr);
+        REQUIRE(tp != NULL);
+
+        WHEN("時間のかかるジョブをまとめて追加する") {
+            const int num_jobs = 16;
+            auto slow = [](void *arg) -> int {
+                (void)arg;
+                msleep(20);
+                return 0;
+            };
+
+            std::unique_ptr<tstats_t> stats(new tstats_t());
+            tgroup_t grp = thrdpool_group_create(tp);
+            REQUIRE(grp != NULL);
+            for (int i = 0; i < num_jobs; ++i) {
+                job_t job;
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(slow), NULL);
+                REQUIRE(thrdpool_group_add(grp, &job) == 0);
+            }
+            size_t peak = 0;
+            for (int i = 0; i < 10; ++i) {
+                REQUIRE(thrdpool_stats(tp, stats.get()) == 0);
+                peak = std::max(peak, stats->num_alive);
+                msleep(5);
+            }
+            REQUIRE(thrdpool_group_wait(grp) == 0);
+            REQUIRE(thrdpool_group_destroy(grp) == 0);
+
+            THEN("ワーカーが増え、アイドル後に元の数へ戻ること") {
+                CHECK(stats->num_workers == max_workers);
+                CHECK(peak > min_workers);
+                CHECK(peak <= max_workers);
+
+                int64_t base = getuptime(0);
+                do {
+                    msleep(10);
+                    REQUIRE(thrdpool_stats(tp, stats.get()) == 0);
+                } while ((stats->num_alive > min_workers) && (getuptime(base) < 5000));
+                CHECK(stats->num_alive == min_workers);
+            }
+        }
+
+        WHEN("範囲外の上限を指定する") {
+            tpool_attr_t bad;
+            REQUIRE(thrdpool_attr_init(&bad, 2) == 0);
+
+            THEN("エラーになること") {
+                CHECK(thrdpool_attr_set_elastic(&bad, 1, 1, 50) == -1);
+                CHECK(errno == EINVAL);
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+}
+
+SCENARIO("スレッドプールを停止できること", tags("thread_pool", "thrdpool_shutdown", "thrdpool_wait_idle")) {
+
+    GIVEN("スレッドプールを作成しておく") {
+        tpool_t tp = thrdpool_create(1);
+        REQUIRE(tp != NULL);
+
+        std::atomic<int> count{0};
+        auto slow = [&](void *) -> int {
+            msleep(10);
+            count += 1;
+            return 0;
+        };
+
+        WHEN("ジョブを追加してアイドルになるまで待つ") {
+            const int num_jobs = 10;
+            for (int i = 0; i < num_jobs; ++i) {
+                job_t job;
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(slow), NULL);
+                REQUIRE(thrdpool_add(tp, &job) == 0);
+            }
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+
+            THEN("全てのジョブが実行されていること") {
+                CHECK(count == num_jobs);
+            }
+        }
+
+        WHEN("キューを実行し切ってから停止する") {
+            const int num_jobs = 10;
+            for (int i = 0; i < num_jobs; ++i) {
+                job_t job;
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(slow), NULL);
+                REQUIRE(thrdpool_add(tp, &job) == 0);
+            }
+            REQUIRE(thrdpool_shutdown(tp, THRDPOOL_DRAIN, THRDPOOL_FOREVER) == 0);
+
+            THEN("全てのジョブが実行され, 以降は追加できないこと") {
+                CHECK(count == num_jobs);
+
+                job_t job;
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(slow), NULL);
+                CHECK(thrdpool_add(tp, &job) == -1);
+                CHECK(errno == ESHUTDOWN);
+                CHECK(thrdpool_add_after(tp, &job, 1) == -1);
+                CHECK(errno == ESHUTDOWN);
+            }
+        }
+
+        WHEN("キューを破棄して停止する") {
+            const int num_jobs = 10;
+            std::vector<job_t> jobs(num_jobs);
+            for (auto &job : jobs) {
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(slow), NULL);
+                thrdpool_job_set_waitable(&job, true);
+                REQUIRE(thrdpool_add(tp, &job) == 0);
+            }
+            REQUIRE(thrdpool_shutdown(tp, THRDPOOL_DISCARD, THRDPOOL_FOREVER) == 0);
+
+            THEN("実行されなかったジョブは取り消されていること") {
+                int cancelled = 0;
+                for (auto &job : jobs) {
+                    jresult_t result;
+                    REQUIRE(thrdpool_wait(job.handle, &result) == 0);
+                    if (result.value == -ECANCELED) {
+                        ++cancelled;
+                    }
+                }
+                CHECK(cancelled > 0);
+                CHECK(count + cancelled == num_jobs);
+            }
+        }
+
+        WHEN("期限内に実行し切れない") {
+            const int num_jobs = 20;
+            for (int i = 0; i < num_jobs; ++i) {
+                job_t job;
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(slow), NULL);
+                REQUIRE(thrdpool_add(tp, &job) == 0);
+            }
+
+            THEN("期限切れになり, 破棄を指定すれば停止できること") {
+                CHECK(thrdpool_shutdown(tp, THRDPOOL_DRAIN, 30) == -1);
+                CHECK(errno == ETIMEDOUT);
+                CHECK(thrdpool_shutdown(tp, THRDPOOL_DRAIN | THRDPOOL_DISCARD, 30) == 0);
+                CHECK(count > 0);
+                CHECK(count < num_jobs);
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+
+    GIVEN("キューの容量を絞ったスレッドプールを作成しておく") {
+        tpool_attr_t attr;
+        REQUIRE(thrdpool_attr_init(&attr, 1) == 0);
+        REQUIRE(thrdpool_attr_set_capacity(&attr, 4) == 0);
+        tpool_t tp = thrdpool_create_attr(&attr);
+        REQUIRE(tp != NULL);
+
+        std::atomic<int> count{0};
+        auto slow = [&](void *) -> int {
+            msleep(10);
+            count += 1;
+            return 0;
+        };
+
+        WHEN("キューが埋まった状態で遅延実行の期限が来てから破棄して停止する") {
+            promise_t started = PROMISE_INITIALIZER;
+            future_t *started_ftr = promise_get_future(&started);
+            auto blocker = [&](void *) -> int {
+                promise_set_value(&started, 0);
+                msleep(50);
+                return 0;
+            };
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(blocker), NULL);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            future_get_value(started_ftr, NULL);
+            for (int i = 0; i < 4; ++i) {
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(slow), NULL);
+                REQUIRE(thrdpool_add(tp, &job) == 0);
+            }
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(slow), NULL);
+            thrdpool_job_set_waitable(&job, true);
+            REQUIRE(thrdpool_add_after(tp, &job, 1) == 0);
+            msleep(10);
+            REQUIRE(thrdpool_shutdown(tp, THRDPOOL_DISCARD, THRDPOOL_FOREVER) == 0);
+
+            THEN("キューのジョブを待たずに遅延実行のジョブも取り消されること") {
+                jresult_t result;
+                REQUIRE(thrdpool_wait(job.handle, &result) == 0);
+                CHECK(result.value == -ECANCELED);
+                CHECK(count == 0);
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+}
+
+SCENARIO("優先度の高いジョブから実行されること", tags("thread_pool", "thrdpool_job_set_priority")) {
+
+    GIVEN("ワーカーが塞がったスレッドプールを作成しておく") {
+        tpool_t tp = thrdpool_create(1);
+        REQUIRE(tp != NULL);
+
+        promise_t started = PROMISE_INITIALIZER;
+        future_t *started_ftr = promise_get_future(&started);
+        promise_t release = PROMISE_INITIALIZER;
+        future_t *release_ftr = promise_get_future(&release);
+        auto blocker = [&](void *) -> int {
+            promise_set_value(&started, 0);
+            future_get_value(release_ftr, NULL);
+            return 0;
+        };
+        std::mutex mtx;
+        std::vector<int> order;
+        auto record = [&](void *arg) -> int {
+            std::lock_guard<std::mutex> lock(mtx);
+            order.push_back((int)(intptr_t)arg);
+            return 0;
+        };
+
+        job_t job;
+        thrdpool_job_init(&job, Lambda::ptr<int, void *>(blocker), NULL);
+        REQUIRE(thrdpool_add(tp, &job) == 0);
+        future_get_value(started_ftr, NULL);
+
+        WHEN("優先度の異なるジョブを低い順に追加する") {
+            const enum thrdpool_priority prios[] = {
+                THRDPOOL_PRIO_LOW, THRDPOOL_PRIO_NORMAL, THRDPOOL_PRIO_HIGH,
+            };
+            for (auto prio : prios) {
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(record), (void *)(intptr_t)prio);
+                REQUIRE(thrdpool_job_set_priority(&job, prio) == 0);
+                REQUIRE(thrdpool_add(tp, &job) == 0);
+            }
+            promise_set_value(&release, 0);
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+
+            THEN("優先度の高い順に実行されること") {
+                REQUIRE(order.size() == 3);
+                CHECK(order[0] == THRDPOOL_PRIO_HIGH);
+                CHECK(order[1] == THRDPOOL_PRIO_NORMAL);
+                CHECK(order[2] == THRDPOOL_PRIO_LOW);
+            }
+        }
+
+        WHEN("優先度の低いジョブの後に高いジョブを大量に追加する") {
+            const int num_jobs = 200;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(record), (void *)(intptr_t)THRDPOOL_PRIO_LOW);
+            REQUIRE(thrdpool_job_set_priority(&job, THRDPOOL_PRIO_LOW) == 0);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            for (int i = 0; i < num_jobs; ++i) {
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(record), (void *)(intptr_t)THRDPOOL_PRIO_HIGH);
+                REQUIRE(thrdpool_job_set_priority(&job, THRDPOOL_PRIO_HIGH) == 0);
+                REQUIRE(thrdpool_add(tp, &job) == 0);
+            }
+            promise_set_value(&release, 0);
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+
+            THEN("優先度の低いジョブも途中で実行されること") {
+                REQUIRE(order.size() == (size_t)num_jobs + 1);
+                auto low = std::find(order.begin(), order.end(), (int)THRDPOOL_PRIO_LOW);
+                REQUIRE(low != order.end());
+                CHECK((low - order.begin()) < num_jobs / 2);
+            }
+        }
+
+        WHEN("優先度の混在したジョブをまとめて追加する") {
+            job_t jobs[2];
+            thrdpool_job_init(&jobs[0], Lambda::ptr<int, void *>(record), NULL);
+            thrdpool_job_init(&jobs[1], Lambda::ptr<int, void *>(record), NULL);
+            REQUIRE(thrdpool_job_set_priority(&jobs[1], THRDPOOL_PRIO_HIGH) == 0);
+
+            THEN("追加できないこと") {
+                CHECK(thrdpool_add_batch(tp, jobs, 2) == -1);
+                CHECK(errno == EINVAL);
+                CHECK(thrdpool_job_set_priority(&jobs[0], (enum thrdpool_priority)THRDPOOL_PRIORITIES) == -1);
+            }
+            promise_set_value(&release, 0);
+        }
+
+        thrdpool_destroy(tp);
+    }
+}
+
+SCENARIO("締め切りの早いジョブから実行されること", tags("thread_pool", "thrdpool_attr_set_deadline_mode", "thrdpool_job_set_deadline")) {
+
+    GIVEN("締め切り順モードのスレッドプールを作成しておく") {
+        tpool_attr_t attr;
+        REQUIRE(thrdpool_attr_init(&attr, 1) == 0);
+
+        promise_t started = PROMISE_INITIALIZER;
+        future_t *started_ftr = promise_get_future(&started);
+        promise_t release = PROMISE_INITIALIZER;
+        future_t *release_ftr = promise_get_future(&release);
+        auto blocker = [&](void *) -> int {
+            promise_set_value(&started, 0);
+            future_get_value(release_ftr, NULL);
+            return 0;
+        };
+        std::mutex mtx;
+        std::vector<int> order;
+        auto record = [&](void *arg) -> int {
+            std::lock_guard<std::mutex> lock(mtx);
+            order.push_back((int)(intptr_t)arg);
+            return 0;
+        };
+        int64_t now = getuptime(0) * 1000000;
+
+        WHEN("締め切りの遅い順にジョブを追加する") {
+            REQUIRE(thrdpool_attr_set_deadline_mode(&attr, true, false) == 0);
+            tpool_t tp = thrdpool_create_attr(&attr);
+            REQUIRE(tp != NULL);
+
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(blocker), NULL);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            future_get_value(started_ftr, NULL);
+
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(record), (void *)0);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            for (int i = 5; i > 0; --i) {
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(record), (void *)(intptr_t)i);
+                REQUIRE(thrdpool_job_set_deadline(&job, now + (i * 1000000000LL)) == 0);
+                REQUIRE(thrdpool_add(tp, &job) == 0);
+            }
+            promise_set_value(&release, 0);
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+            thrdpool_destroy(tp);
+
+            THEN("締め切りの早い順に実行され, 締め切りのないジョブは最後になること") {
+                CHECK(order == std::vector<int>({1, 2, 3, 4, 5, 0}));
+            }
+        }
+
+        WHEN("期限切れを破棄する設定で締め切りの過ぎたジョブを追加する") {
+            REQUIRE(thrdpool_attr_set_deadline_mode(&attr, true, true) == 0);
+            tpool_t tp = thrdpool_create_attr(&attr);
+            REQUIRE(tp != NULL);
+
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(blocker), NULL);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            future_get_value(started_ftr, NULL);
+
+            job_t expired;
+            thrdpool_job_init(&expired, Lambda::ptr<int, void *>(record), (void *)1);
+            thrdpool_job_set_waitable(&expired, true);
+            REQUIRE(thrdpool_job_set_deadline(&expired, now + 10000000) == 0);
+            REQUIRE(thrdpool_add(tp, &expired) == 0);
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(record), (void *)2);
+            REQUIRE(thrdpool_job_set_deadline(&job, now + 60000000000LL) == 0);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            msleep(20);
+            promise_set_value(&release, 0);
+
+            jresult_t result;
+            REQUIRE(thrdpool_wait(expired.handle, &result) == 0);
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+            tstats_t stats = {};
+            REQUIRE(thrdpool_stats(tp, &stats) == 0);
+            thrdpool_destroy(tp);
+
+            THEN("期限切れのジョブは実行されずに破棄されること") {
+                CHECK(result.value == -ETIMEDOUT);
+                CHECK(order == std::vector<int>({2}));
+                CHECK(stats.workers[0].expired == 1);
+            }
+        }
+    }
+}
+
+SCENARIO("取り消したジョブが実行されないこと", tags("thread_pool", "thrdpool_job_set_cancel", "thrdpool_cancel_tag")) {
+
+    GIVEN("実行中のジョブで塞いだスレッドプールを作成しておく") {
+        tpool_t tp = thrdpool_create(1);
+        REQUIRE(tp != NULL);
+
+        promise_t started = PROMISE_INITIALIZER;
+        future_t *started_ftr = promise_get_future(&started);
+        promise_t release = PROMISE_INITIALIZER;
+        future_t *release_ftr = promise_get_future(&release);
+        auto blocker = [&](void *) -> int {
+            promise_set_value(&started, 0);
+            future_get_value(release_ftr, NULL);
+            return thrdpool_cancelled() ? -ECANCELED : 0;
+        };
+        std::mutex mtx;
+        std::vector<int> order;
+        auto record = [&](void *arg) -> int {
+            std::lock_guard<std::mutex> lock(mtx);
+            order.push_back((int)(intptr_t)arg);
+            return 0;
+        };
+
+        tcancel_t cancel = thrdpool_cancel_create();
+        REQUIRE(cancel != NULL);
+
+        WHEN("トークン付きのジョブを追加してから取り消す") {
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(blocker), NULL);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            future_get_value(started_ftr, NULL);
+
+            job_t waitable;
+            thrdpool_job_init(&waitable, Lambda::ptr<int, void *>(record), (void *)1);
+            thrdpool_job_set_waitable(&waitable, true);
+            REQUIRE(thrdpool_job_set_cancel(&waitable, cancel) == 0);
+            REQUIRE(thrdpool_add(tp, &waitable) == 0);
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(record), (void *)2);
+            REQUIRE(thrdpool_job_set_cancel(&job, cancel) == 0);
+            CHECK(thrdpool_add_every(tp, &job, 10) == -1);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(record), (void *)3);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+
+            REQUIRE(thrdpool_cancel_request(cancel) == 0);
+            thrdpool_cancel_destroy(cancel);
+            promise_set_value(&release, 0);
+
+            jresult_t result;
+            REQUIRE(thrdpool_wait(waitable.handle, &result) == 0);
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+            tstats_t stats = {};
+            REQUIRE(thrdpool_stats(tp, &stats) == 0);
+
+            THEN("取り消したジョブだけ実行されずに破棄されること") {
+                CHECK(result.value == -ECANCELED);
+                CHECK(order == std::vector<int>({3}));
+                CHECK(stats.workers[0].cancelled == 2);
+            }
+        }
+
+        WHEN("タグ付きのジョブを追加してからタグごと取り消す") {
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(blocker), NULL);
+            thrdpool_job_set_waitable(&job, true);
+            REQUIRE(thrdpool_job_set_tag(&job, 7) == 0);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            jhandle_t running = job.handle;
+            future_get_value(started_ftr, NULL);
+
+            for (int i = 1; i <= 4; ++i) {
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(record), (void *)(intptr_t)i);
+                REQUIRE(thrdpool_job_set_tag(&job, (i % 2 == 0) ? 7 : 8) == 0);
+                REQUIRE(thrdpool_add(tp, &job) == 0);
+            }
+            REQUIRE(thrdpool_cancel_tag(tp, 7) == 0);
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(record), (void *)5);
+            REQUIRE(thrdpool_job_set_tag(&job, 7) == 0);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            promise_set_value(&release, 0);
+
+            jresult_t result;
+            REQUIRE(thrdpool_wait(running, &result) == 0);
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+            thrdpool_cancel_destroy(cancel);
+
+            THEN("実行中のジョブは取り消しを検知し, 後から追加したジョブは実行されること") {
+                CHECK(result.value == -ECANCELED);
+                CHECK(order == std::vector<int>({1, 3, 5}));
+            }
+        }
+
+        WHEN("トークンを設定したグループにジョブを追加してから取り消す") {
+            tgroup_t grp = thrdpool_group_create(tp);
+            REQUIRE(grp != NULL);
+            REQUIRE(thrdpool_group_set_cancel(grp, cancel) == 0);
+            thrdpool_cancel_destroy(cancel);
+
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(blocker), NULL);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            future_get_value(started_ftr, NULL);
+            for (int i = 1; i <= 3; ++i) {
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(record), (void *)(intptr_t)i);
+                REQUIRE(thrdpool_group_add(grp, &job) == 0);
+            }
+            REQUIRE(thrdpool_cancel_request(cancel) == 0);
+            promise_set_value(&release, 0);
+            REQUIRE(thrdpool_group_wait(grp) == 0);
+            REQUIRE(thrdpool_group_destroy(grp) == 0);
+
+            THEN("グループのジョブは実行されないこと") {
+                CHECK(order.empty());
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+}
+
+SCENARIO("テナント間で重みに応じて実行時間が配分されること", tags("thread_pool", "thrdpool_tenant_create", "thrdpool_tenant_stats")) {
+
+    GIVEN("重みの異なるテナントを持つスレッドプールを作成しておく") {
+        tpool_t tp = thrdpool_create(1);
+        REQUIRE(tp != NULL);
+        ttenant_t light = thrdpool_tenant_create(tp, 1);
+        REQUIRE(light != NULL);
+        ttenant_t heavy = thrdpool_tenant_create(tp, 3);
+        REQUIRE(heavy != NULL);
+
+        promise_t started = PROMISE_INITIALIZER;
+        future_t *started_ftr = promise_get_future(&started);
+        promise_t release = PROMISE_INITIALIZER;
+        future_t *release_ftr = promise_get_future(&release);
+        auto blocker = [&](void *) -> int {
+            promise_set_value(&started, 0);
+            future_get_value(release_ftr, NULL);
+            return 0;
+        };
+        std::mutex mtx;
+        std::vector<int> order;
+        auto spin = [&](void *arg) -> int {
+            int64_t begin = getuptime(0);
+            while (getuptime(0) - begin < 2) {
+            }
+            std::lock_guard<std::mutex> lock(mtx);
+            order.push_back((int)(intptr_t)arg);
+            return 0;
+        };
+
+        WHEN("軽いテナントが先に大量のジョブを追加する") {
+            const int num_jobs = 40;
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(blocker), NULL);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            future_get_value(started_ftr, NULL);
+
+            for (int i = 0; i < num_jobs; ++i) {
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(spin), (void *)1);
+                REQUIRE(thrdpool_job_set_tenant(&job, light) == 0);
+                REQUIRE(thrdpool_add(tp, &job) == 0);
+            }
+            job_t jobs[num_jobs];
+            for (int i = 0; i < num_jobs; ++i) {
+                thrdpool_job_init(&jobs[i], Lambda::ptr<int, void *>(spin), (void *)3);
+                REQUIRE(thrdpool_job_set_tenant(&jobs[i], heavy) == 0);
+            }
+            REQUIRE(thrdpool_add_batch(tp, jobs, num_jobs) == 0);
+            CHECK(thrdpool_add_after(tp, &jobs[0], 10) == -1);
+
+            ttstats_t queued;
+            REQUIRE(thrdpool_tenant_stats(heavy, &queued) == 0);
+            promise_set_value(&release, 0);
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+            ttstats_t light_stats, heavy_stats;
+            REQUIRE(thrdpool_tenant_stats(light, &light_stats) == 0);
+            REQUIRE(thrdpool_tenant_stats(heavy, &heavy_stats) == 0);
+
+            THEN("重いテナントのジョブが重みに応じて多く実行されること") {
+                REQUIRE(order.size() == (size_t)num_jobs * 2);
+                int first_heavy = (int)std::count(order.begin(), order.begin() + 20, 3);
+                CHECK(first_heavy >= 12);
+                CHECK(first_heavy < 20);
+            }
+            THEN("テナントごとの待ち数と実行時間が取得できること") {
+                CHECK(queued.weight == 3);
+                CHECK(queued.depth == (size_t)num_jobs);
+                CHECK(heavy_stats.depth == 0);
+                CHECK(light_stats.served == (uint64_t)num_jobs);
+                CHECK(heavy_stats.served == (uint64_t)num_jobs);
+                CHECK(heavy_stats.served_time >= (uint64_t)num_jobs * 1000000);
+            }
+        }
+
+        WHEN("テナントのジョブに通常以外の優先度を設定する") {
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(spin), (void *)1);
+            REQUIRE(thrdpool_job_set_tenant(&job, light) == 0);
+            REQUIRE(thrdpool_job_set_priority(&job, THRDPOOL_PRIO_HIGH) == 0);
+
+            THEN("追加がエラーになること") {
+                CHECK(thrdpool_add(tp, &job) == -1);
+                CHECK(errno == EINVAL);
+                CHECK(thrdpool_add_batch(tp, &job, 1) == -1);
+                CHECK(errno == EINVAL);
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+}
+
+SCENARIO("ブロックしたワーカーの代わりが起動されること", tags("thread_pool", "thrdpool_attr_set_compensation", "thrdpool_blocking_begin")) {
+
+    GIVEN("ワーカー1つに予備を1つ持つスレッドプールを作成しておく") {
+        tpool_attr_t attr;
+        REQUIRE(thrdpool_attr_init(&attr, 1) == 0);
+        REQUIRE(thrdpool_attr_set_compensation(&attr, 1, 20) == 0);
+        tpool_t tp = thrdpool_create_attr(&attr);
+        REQUIRE(tp != NULL);
+
+        promise_t release = PROMISE_INITIALIZER;
+        future_t *release_ftr = promise_get_future(&release);
+        std::atomic<int> blocked{0};
+
+        WHEN("後続のジョブを待ってブロックするジョブを追加する") {
+            auto waiter = [&](void *) -> int {
+                thrdpool_blocking_begin();
+                blocked = 1;
+                future_get_value(release_ftr, NULL);
+                thrdpool_blocking_end();
+                return 0;
+            };
+            auto releaser = [&](void *) -> int {
+                promise_set_value(&release, 0);
+                return 0;
+            };
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(waiter), NULL);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            while (blocked == 0) {
+                msleep(1);
+            }
+            tstats_t stats = {};
+            REQUIRE(thrdpool_stats(tp, &stats) == 0);
+            CHECK(stats.num_blocked == 1);
+            CHECK(stats.workers[0].blocked);
+
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(releaser), NULL);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+            REQUIRE(thrdpool_stats(tp, &stats) == 0);
+
+            THEN("予備のワーカーが後続のジョブを実行すること") {
+                CHECK(stats.num_blocked == 0);
+                CHECK(stats.compensations >= 1);
+            }
+        }
+
+        WHEN("ジョブの中で自分の追加したジョブの完了を待つ") {
+            auto child = [](void *) -> int {
+                return 7;
+            };
+            jresult_t result = {};
+            auto parent = [&](void *) -> int {
+                job_t job;
+                thrdpool_job_init(&job, child, NULL);
+                thrdpool_job_set_waitable(&job, true);
+                if (thrdpool_add(tp, &job) != 0) {
+                    return -1;
+                }
+                return thrdpool_wait(job.handle, &result);
+            };
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(parent), NULL);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+
+            THEN("待っているジョブが予備のワーカーに盗まれて実行されること") {
+                CHECK(result.value == 7);
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+}
+
+SCENARIO("アイドル中のワーカーを待機させずに回し続けられること", tags("thread_pool", "thrdpool_attr_set_busy_poll")) {
+
+    GIVEN("ビジーポーリングするスレッドプールを作成しておく") {
+        tpool_attr_t attr;
+        REQUIRE(thrdpool_attr_init(&attr, 2) == 0);
+        REQUIRE(thrdpool_attr_set_busy_poll(&attr, true) == 0);
+
+        tpool_t tp = thrdpool_create_attr(&attr);
+        REQUIRE(tp != NULL);
+
+        WHEN("間隔を空けてジョブを追加する") {
+            const int num_jobs = 20;
+            std::atomic<int> count{0};
+            for (int i = 0; i < num_jobs; ++i) {
+                job_t job;
+                thrdpool_job_init(&job, count_job, &count);
+                REQUIRE(thrdpool_add(tp, &job) == 0);
+                msleep(1);
+            }
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+
+            THEN("全て実行され, ワーカーは一度も待機しないこと") {
+                CHECK(count == num_jobs);
+
+                std::unique_ptr<tstats_t> stats(new tstats_t());
+                REQUIRE(thrdpool_stats(tp, stats.get()) == 0);
+                for (size_t i = 0; i < stats->num_workers; ++i) {
+                    CHECK(stats->workers[i].parks == 0);
+                }
+            }
+        }
+
+        thrdpool_destroy(tp);
+    }
+}
+
+SCENARIO("ジョブの引数をジョブ内に複製して渡せること", tags("thread_pool", "thrdpool_job_set_inline_arg", "thrdpool_job_set_destructor")) {
+
+    GIVEN("スレッドプールを作成しておく") {
+        tpool_t tp = thrdpool_create(1);
+        REQUIRE(tp != NULL);
+
+        struct payload {
+            int index;
+            char text[40];
+        };
+        std::atomic<int> sum{0};
+        std::atomic<int> released{0};
+        auto reader = [&](void *arg) -> int {
+            struct payload *p = (struct payload *)arg;
+            if (strcmp(p->text, "inline") == 0) {
+                sum += p->index;
+            }
+            return 0;
+        };
+        auto release = [&](void *arg) {
+            struct payload *p = (struct payload *)arg;
+            memset(p, 0, sizeof(*p));
+            released += 1;
+        };
+
+        WHEN("引数を複製したジョブを追加し, 元の引数を書き換える") {
+            const int num_jobs = 10;
+            for (int i = 1; i <= num_jobs; ++i) {
+                struct payload p = {i, "inline"};
+                job_t job;
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(reader), NULL);
+                REQUIRE(thrdpool_job_set_inline_arg(&job, &p, sizeof(p)) == 0);
+                REQUIRE(thrdpool_job_set_destructor(&job, Lambda::ptr<void, void *>(release)) == 0);
+                REQUIRE(thrdpool_add(tp, &job) == 0);
+                strcpy(p.text, "changed");
+            }
+            REQUIRE(thrdpool_wait_idle(tp) == 0);
+
+            THEN("複製された引数で実行され, 全て解放されること") {
+                CHECK(sum == (num_jobs * (num_jobs + 1)) / 2);
+                CHECK(released == num_jobs);
+            }
+        }
+
+        WHEN("実行前に破棄する") {
+            promise_t started = PROMISE_INITIALIZER;
+            future_t *started_ftr = promise_get_future(&started);
+            auto blocker = [&](void *) -> int {
+                promise_set_value(&started, 0);
+                msleep(20);
+                return 0;
+            };
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(blocker), NULL);
+            REQUIRE(thrdpool_add(tp, &job) == 0);
+            future_get_value(started_ftr, NULL);
+
+            const int num_jobs = 10;
+            for (int i = 1; i <= num_jobs; ++i) {
+                struct payload p = {i, "inline"};
+                thrdpool_job_init(&job, Lambda::ptr<int, void *>(reader), NULL);
+                REQUIRE(thrdpool_job_set_inline_arg(&job, &p, sizeof(p)) == 0);
+                REQUIRE(thrdpool_job_set_destructor(&job, Lambda::ptr<void, void *>(release)) == 0);
+                REQUIRE(thrdpool_add(tp, &job) == 0);
+            }
+            REQUIRE(thrdpool_shutdown(tp, THRDPOOL_DISCARD, THRDPOOL_FOREVER) == 0);
+
+            THEN("実行されなかった引数も解放されること") {
+                CHECK(sum == 0);
+                CHECK(released == num_jobs);
+            }
+        }
+
+        WHEN("大きすぎる引数を複製する") {
+            char big[JOB_INLINE_MAX + 1] = {0};
+            job_t job;
+            thrdpool_job_init(&job, Lambda::ptr<int, void *>(reader), NULL);
+
+            THEN("エラーになること") {
+                CHECK(thrdpool_job_set_inline_arg(&job, big, sizeof(big)) == -1);
+                CHECK(errno == EINVAL);
+            }
+        }
+
         thrdpool_destroy(tp);
     }
 }
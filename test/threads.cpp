@@ -11,6 +11,7 @@
 #include <cstdint>
 #include <cerrno>
 #include <atomic>
+#include <memory>
 #include <catch2/catch.hpp>
 
 using Catch::Matchers::Equals;
@@ -134,23 +135,26 @@ SCENARIO("スレッドが停止出来ること", tags("threads", "thrd_suspend",
 
     GIVEN("スレッドが動作済みであること") {
         auto runner = [&](void *arg) -> int {
-            promise_t *prms = (promise_t *)arg;
+            /* The detached runner may outlive the WHEN block, so it shares the promise. */
+            std::unique_ptr<std::shared_ptr<promise_t>> prms((std::shared_ptr<promise_t> *)arg);
             int64_t base = getuptime(0);
             struct timespec ts = {
                 .tv_sec = 1,
                 .tv_nsec = 0,
             };
             thrd_sleep(&ts);
-            promise_set_value(prms, getuptime(base));
+            promise_set_value(prms->get(), getuptime(base));
             return 0;
         };
 
         WHEN("スレッドを停止させる") {
-            promise_t prms = PROMISE_INITIALIZER;
-            future_t *ftr = promise_get_future(&prms);
+            auto prms = std::make_shared<promise_t>();
+            promise_init(prms.get());
+            future_t *ftr = promise_get_future(prms.get());
 
             thrd_t thr;
-            REQUIRE(thrd_create(&thr, Lambda::ptr<int, void *>(runner), &prms) == 0);
+            REQUIRE(thrd_create(&thr, Lambda::ptr<int, void *>(runner),
+                                new std::shared_ptr<promise_t>(prms)) == 0);
             REQUIRE(thrd_detach(thr) == 0);
 
             THEN("停止出来ること") {
@@ -197,3 +201,80 @@ SCENARIO("スレッドの名前を変更できること", tags("threads", "thrd_
         REQUIRE(thrd_join(thr, NULL) == 0);
     }
 }
+
+SCENARIO("スレッドの優先度とアフィニティを変更できること", tags("threads", "thrd_set_prior", "thrd_set_affinity")) {
+
+    GIVEN("スレッドが動作済みであること") {
+        auto runner = [&](void *) -> int {
+            struct timespec ts = {
+                .tv_sec = 5,
+                .tv_nsec = 0,
+            };
+            thrd_sleep(&ts);
+            return 0;
+        };
+
+        thrd_t thr;
+        REQUIRE(thrd_create(&thr, Lambda::ptr<int, void *>(runner), NULL) == 0);
+
+        WHEN("スレッドの優先度を下げる") {
+            REQUIRE(thrd_set_prior(thr, 5) == 0);
+
+            THEN("設定出来ること") {
+                errno = 0;
+                CHECK(thrd_get_prior(thr) == 5);
+                CHECK(errno == 0);
+            }
+        }
+
+        WHEN("スレッドを 1 つの CPU に固定する") {
+            cpu_set_t allowed;
+            REQUIRE(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+            int cpu = 0;
+            while (!CPU_ISSET(cpu, &allowed)) {
+                ++cpu;
+            }
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpu, &cpuset);
+
+            INFO("CPU: " + std::to_string(cpu));
+
+            REQUIRE(thrd_set_affinity(thr, &cpuset) == 0);
+
+            THEN("設定出来ること") {
+                cpu_set_t result;
+                REQUIRE(thrd_get_affinity(thr, &result) == 0);
+                CHECK(CPU_EQUAL(&result, &cpuset));
+            }
+        }
+
+        REQUIRE(thrd_cancel(thr) == 0);
+        REQUIRE(thrd_join(thr, NULL) == 0);
+    }
+}
+
+SCENARIO("CPU トポロジが取得できること", tags("threads", "thrd_get_topology")) {
+
+    GIVEN("トポロジを取得する") {
+        std::unique_ptr<cpu_topo_t> topo(new cpu_topo_t());
+        REQUIRE(thrd_get_topology(topo.get()) == 0);
+
+        THEN("使用可能な CPU が全て含まれること") {
+            cpu_set_t allowed;
+            REQUIRE(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+            CHECK(topo->num_cpus == (size_t)CPU_COUNT(&allowed));
+            CHECK(topo->num_cores >= 1);
+            CHECK(topo->num_cores <= topo->num_cpus);
+            CHECK(topo->num_llcs >= 1);
+            CHECK(topo->num_nodes >= 1);
+            for (size_t i = 0; i < topo->num_cpus; ++i) {
+                CHECK(CPU_ISSET(topo->cpus[i].cpu, &allowed));
+                CHECK(topo->cpus[i].core < (int)topo->num_cores);
+                CHECK(topo->cpus[i].llc < (int)topo->num_llcs);
+                CHECK(topo->cpus[i].node < (int)topo->num_nodes);
+            }
+        }
+    }
+}
+